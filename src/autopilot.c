@@ -0,0 +1,313 @@
+/*******************************************************************************************
+*
+*   Nokia Pod Racer
+*   Autopilot: obstacle avoiding steering towards the carrot.
+*
+*   Every frame a fan of feelers is swept from the pod. The heading that gets closest to the
+*   carrot without running into an obstacle soon is chosen, and the speed is limited by the
+*   free distance ahead so the pod can always slow down before touching anything: hits slower
+*   than the crash speed are never fatal. Near the carrot, where steering alone tends to circle
+*   around it, the turbos are chosen by simulating the next frames instead. Moving hazards crash
+*   the pod even when it stands still, so the chosen turbos are also simulated for a while and,
+*   if a hazard would run into the pod, swapped for the closest ones that get out of its way.
+*
+*   Copyright (c) 2023 Francisco Casas (@autopawn)
+*
+********************************************************************************************/
+
+#include "raylib.h"
+#include "raymath.h"
+#include "autopilot.h"
+
+#include <math.h>
+
+#define AUTOPILOT_FEELERS 16
+#define AUTOPILOT_ROLLOUT_FRAMES 60
+#define AUTOPILOT_SAFETY_FRAMES 30
+#define WEDGED_TURN_TIME 120
+
+static const float FEELER_LENGTH = 8.0;
+static const float FEELER_RAD = 0.5;            // Wider than the pod, to keep some margin
+static const float MAX_SPEED = 0.35;
+static const float BRAKE_MARGIN = 1.0;          // Distance kept to the obstacles when braking
+static const float ROLLOUT_DISTANCE = 10.0;     // Carrots closer than this are aimed by simulating
+static const float ROLLOUT_TURBOS[] = {0, 0.5, 1, 1.5, 2};
+
+//----------------------------------------------------------------------------------
+// Module Functions Definition
+//----------------------------------------------------------------------------------
+
+static float WrapAngle(float angle)
+{
+    while (angle > PI)
+        angle -= 2*PI;
+    while (angle < -PI)
+        angle += 2*PI;
+    return angle;
+}
+
+// Speed at which hitting something is never fatal, with some margin
+static float SafeSpeed(const Level *level)
+{
+    return 0.8f*level->physics.crash_speed;
+}
+
+static float MaxAngSpeed(const Level *level)
+{
+    return 1.5f*level->physics.ang_gain;
+}
+
+// Tightest turn the pod can do, with some margin. Turning at full rate the pod goes forward
+// 0.06/ang_gain units per radian.
+static float TurnRadius(const Level *level)
+{
+    return 0.1f/level->physics.ang_gain;
+}
+
+// Distance that can be travelled from the pod in the given absolute direction, against the
+// obstacles and the moving hazards. The pod is taken to go along the feeler at its current speed,
+// or the safe speed if slower, to know where the hazards will be when it gets there.
+// Sweeps don't stop moves that start inside an obstacle and leave it, so when the pod is that
+// close to one the margin is dropped and a first short step is checked on its own.
+static float FreeDistance(Level *level, const Player *player, float ang)
+{
+    Vector3 dir = {cosf(ang), 0, -sinf(ang)};
+    float rad = FEELER_RAD;
+    int clock = player->time_playing;
+
+    if (LevelCheckCollision(level, player->pos, FEELER_RAD, clock))
+    {
+        Vector3 step = Vector3Scale(dir, SafeSpeed(level));
+
+        if (LevelSweepCollision(level, player->pos, step, PLAYER_RAD).hit ||
+                LevelSweepTraffic(level, player->pos, step, PLAYER_RAD, clock, 1).hit)
+            return 0;
+        rad = PLAYER_RAD;
+    }
+
+    float speed = sqrtf(player->pos_spd.x*player->pos_spd.x + player->pos_spd.z*player->pos_spd.z);
+    int frames = (int) ceilf(FEELER_LENGTH/fmaxf(speed, SafeSpeed(level)));
+    Vector3 feeler = Vector3Scale(dir, FEELER_LENGTH);
+
+    SweepResult sweep = LevelSweepCollision(level, player->pos, feeler, rad);
+    SweepResult traffic = LevelSweepTraffic(level, player->pos, feeler, rad, clock, frames);
+
+    return fminf(sweep.toi, traffic.toi)*FEELER_LENGTH;
+}
+
+// Fraction of its speed that the pod can lose per frame
+static float Slowdown(const Level *level)
+{
+    return (level->area == LEVEL_ICE)? level->physics.ice_accel : level->physics.accel;
+}
+
+static float MotionAngle(const Player *player)
+{
+    return atan2f(-player->pos_spd.z, player->pos_spd.x);
+}
+
+// Whether the current motion can barely be slowed down to a safe speed before hitting something
+static bool MustBrake(Level *level, const Player *player)
+{
+    float motion = sqrtf(player->pos_spd.x*player->pos_spd.x + player->pos_spd.z*player->pos_spd.z);
+
+    if (motion <= SafeSpeed(level))
+        return false;
+
+    return motion > SafeSpeed(level) + Slowdown(level)*(FreeDistance(level, player, MotionAngle(player)) - BRAKE_MARGIN);
+}
+
+// Direction to drive to, relative to the pod heading
+static float AutopilotTurn(Level *level, const Player *player)
+{
+    float carrot_angle = CarrotAngle(player);
+    float carrot_distance = CarrotDistance(player);
+
+    // A carrot inside the turning circle would be orbited forever, go straight to leave it behind
+    float arc_radius = carrot_distance/(2*fmaxf(absf(sinf(carrot_angle)), 0.001f));
+
+    if (arc_radius < TurnRadius(level))
+        carrot_angle = 0;
+
+    // Nothing in between, go for it
+    if (FreeDistance(level, player, player->ang + carrot_angle) >= fminf(carrot_distance, FEELER_LENGTH))
+        return carrot_angle;
+
+    // Wedged against an obstacle, turn to one side for a while and then try the other
+    if (FreeDistance(level, player, player->ang) == 0)
+        return ((player->time_playing/WEDGED_TURN_TIME) % 2)? PI/2 : -PI/2;
+
+    // Otherwise, the feeler that best points to the carrot while having room ahead
+    float best_score = -INFINITY;
+    float turn = 0;
+
+    for (int i = 0; i < AUTOPILOT_FEELERS; ++i)
+    {
+        float feeler = WrapAngle(2*PI*i/AUTOPILOT_FEELERS);
+        float free = FreeDistance(level, player, player->ang + feeler);
+        float score = -absf(WrapAngle(carrot_angle - feeler)) - 4*(FEELER_LENGTH - free)/FEELER_LENGTH;
+
+        // Keep turning to the same side, instead of hesitating in front of an obstacle
+        if (feeler*player->ang_spd > 0)
+            score += 0.5;
+
+        if (score > best_score)
+        {
+            best_score = score;
+            turn = feeler;
+        }
+    }
+
+    return turn;
+}
+
+// Frames needed to grab the carrot holding the given input. Not grabbing it, crashing or ending
+// too fast to avoid a crash costs AUTOPILOT_ROLLOUT_FRAMES. The pod is simulated as a race of its
+// own, so it is only copied in and out of the race once.
+static int RolloutCost(Level *level, const Player *player, PlayerInput input)
+{
+    RaceState sim;
+
+    sim.players_count = 1;
+    sim.frame = 0;
+    RaceSetPlayer(&sim, 0, player);
+
+    for (int i = 0; i < AUTOPILOT_ROLLOUT_FRAMES; ++i)
+    {
+        int events;
+
+        UpdateRace(level, &sim, &input, &events);
+
+        if (events & SIM_EVENT_CRASH)
+            return AUTOPILOT_ROLLOUT_FRAMES;
+        if (events & SIM_EVENT_CARROT)
+        {
+            Player pod = RacePlayer(&sim, 0);
+            return MustBrake(level, &pod)? AUTOPILOT_ROLLOUT_FRAMES : i;
+        }
+    }
+
+    return AUTOPILOT_ROLLOUT_FRAMES;
+}
+
+// Simulates every combination of turbos for a while, and finds the one that grabs the carrot
+// first. Returns false if none does.
+static bool AutopilotRollout(Level *level, const Player *player, PlayerInput *best_input)
+{
+    const int count = sizeof(ROLLOUT_TURBOS)/sizeof(ROLLOUT_TURBOS[0]);
+
+    int best_cost = AUTOPILOT_ROLLOUT_FRAMES;
+
+    for (int l = 0; l < count; ++l)
+    {
+        for (int r = 0; r < count; ++r)
+        {
+            PlayerInput input = {ROLLOUT_TURBOS[l], ROLLOUT_TURBOS[r]};
+            int cost = RolloutCost(level, player, input);
+
+            if (cost < best_cost)
+            {
+                best_cost = cost;
+                *best_input = input;
+            }
+        }
+    }
+
+    return best_cost < AUTOPILOT_ROLLOUT_FRAMES;
+}
+
+// Whether holding the input crashes the pod in the next frames, which is how the moving hazards
+// that would run into it are noticed. On ice the pod takes longer to get out of the way, so it
+// looks further ahead.
+static bool InputCrashes(Level *level, const Player *player, PlayerInput input)
+{
+    int frames = (level->area == LEVEL_ICE)? 2*AUTOPILOT_SAFETY_FRAMES : AUTOPILOT_SAFETY_FRAMES;
+    RaceState sim;
+
+    sim.players_count = 1;
+    sim.frame = 0;
+    RaceSetPlayer(&sim, 0, player);
+
+    for (int i = 0; i < frames; ++i)
+    {
+        int events;
+
+        UpdateRace(level, &sim, &input, &events);
+
+        if (events & SIM_EVENT_CRASH)
+            return true;
+        if (events & SIM_EVENT_CARROT)
+            return false;
+    }
+
+    return false;
+}
+
+// Input that drives towards the carrot, only minding the obstacles that stand still
+static PlayerInput SteerInput(Level *level, const Player *player)
+{
+    if (MustBrake(level, player))
+        return (PlayerInput){0, 0};
+
+    PlayerInput input = {0};
+
+    if (player->time_playing && CarrotDistance(player) < ROLLOUT_DISTANCE && AutopilotRollout(level, player, &input))
+        return input;
+
+    // Aim for a speed that keeps away from having to brake
+    float turn = AutopilotTurn(level, player);
+    float slowdown = Slowdown(level);
+    float motion_free = FreeDistance(level, player, MotionAngle(player));
+    float ahead = fminf(FreeDistance(level, player, player->ang), motion_free);
+    float speed = Clamp(SafeSpeed(level) + 0.5f*slowdown*(ahead - BRAKE_MARGIN), 0, MAX_SPEED);
+
+    // Slow down to turn, a tight turn is only possible slowly
+    speed *= Clamp(1.2f - absf(turn)/PI, 0.3f, 1);
+
+    // Never faster than the arc to the carrot allows, so it is not circled around
+    float carrot_angle = CarrotAngle(player);
+    float arc_radius = CarrotDistance(player)/(2*fmaxf(absf(sinf(carrot_angle)), 0.001f));
+
+    speed = fminf(speed, MaxAngSpeed(level)*arc_radius);
+
+    // Turbos that aim for that speed and the turn rate towards the chosen direction
+    float ang_spd = Clamp(0.3f*turn, -MaxAngSpeed(level), MaxAngSpeed(level));
+    float diff = ang_spd/level->physics.ang_gain;
+    float sum = speed/0.1f + 0.4f*absf(diff);
+
+    input.turbo_l = Clamp(0.5f*(sum - diff), 0, 2);
+    input.turbo_r = Clamp(0.5f*(sum + diff), 0, 2);
+
+    return input;
+}
+
+PlayerInput AutopilotInput(Level *level, const Player *player)
+{
+    PlayerInput input = SteerInput(level, player);
+
+    if (!player->time_playing || level->traffic_count == 0 || !InputCrashes(level, player, input))
+        return input;
+
+    // A hazard is coming, take the closest turbos that get out of its way
+    const int count = sizeof(ROLLOUT_TURBOS)/sizeof(ROLLOUT_TURBOS[0]);
+
+    PlayerInput best_input = input;
+    float best_change = INFINITY;
+
+    for (int l = 0; l < count; ++l)
+    {
+        for (int r = 0; r < count; ++r)
+        {
+            PlayerInput escape = {ROLLOUT_TURBOS[l], ROLLOUT_TURBOS[r]};
+            float change = absf(escape.turbo_l - input.turbo_l) + absf(escape.turbo_r - input.turbo_r);
+
+            if (change < best_change && !InputCrashes(level, player, escape))
+            {
+                best_change = change;
+                best_input = escape;
+            }
+        }
+    }
+
+    return best_input;
+}
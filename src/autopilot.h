@@ -0,0 +1,31 @@
+/*******************************************************************************************
+*
+*   Nokia Pod Racer
+*   Autopilot: drives a pod towards its carrots while avoiding the obstacles.
+*
+*   It only reads the level and the player, so it gives the same controls for the same
+*   race on every run and can drive headless simulations.
+*
+*   Copyright (c) 2023 Francisco Casas (@autopawn)
+*
+********************************************************************************************/
+
+#ifndef AUTOPILOT_H
+#define AUTOPILOT_H
+
+#include "simulation.h"
+
+#ifdef __cplusplus
+extern "C" {            // Prevents name mangling of functions
+#endif
+
+//----------------------------------------------------------------------------------
+// Autopilot Functions Declaration
+//----------------------------------------------------------------------------------
+PlayerInput AutopilotInput(Level *level, const Player *player);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // AUTOPILOT_H
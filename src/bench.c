@@ -0,0 +1,523 @@
+/*******************************************************************************************
+*
+*   Nokia Pod Racer
+*   Microbenchmarks of the simulation hot paths.
+*
+*   Every benchmark uses fixed seeds and is warmed up before being measured. Results are
+*   written as JSON and, when a baseline file is given, compared against it: the program
+*   fails if the median time of a benchmark got slower than the allowed tolerance. It also
+*   fails if the fixed-point physics, which the game runs, take longer than the float ones.
+*
+*   Usage: simbench [--out results.json] [--baseline baseline.json] [--tolerance 0.1]
+*
+*   Copyright (c) 2023 Francisco Casas (@autopawn)
+*
+********************************************************************************************/
+
+#include "raylib.h"
+#include "simulation.h"
+#include "autopilot.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_SEED 0x5eed
+#define BENCH_WARMUP_SAMPLES 5
+#define BENCH_SAMPLES 50
+#define BENCH_MAX_COUNT 32
+#define BENCH_N_POINTS 4096
+
+//----------------------------------------------------------------------------------
+// Types and Structures Definition
+//----------------------------------------------------------------------------------
+typedef struct
+{
+    const char *name;
+    void (*run)(int ops);       // Runs ops operations
+    int ops;                    // Operations per sample
+} Benchmark;
+
+typedef struct
+{
+    char name[64];
+    double ns_per_op;
+    double p50, p95, p99;
+    double allocs_per_op;
+} BenchResult;
+
+//----------------------------------------------------------------------------------
+// Module Variables Definition (local)
+//----------------------------------------------------------------------------------
+static Level *levels[LEVEL_COUNT];
+static Vector3 points[BENCH_N_POINTS];
+static Vector3 moves[BENCH_N_POINTS];
+static Level *fixedLevel;                   // City level with fixed-point physics
+static Level *endlessLevel;                 // Endless forest
+static int endlessChunksVisited = 0;
+static Player benchPlayer;
+static RaceState benchRace;                 // Races of one pod, as the game and the tools run them
+static RaceState fixedBenchRace;
+static RaceState autopilotRace;
+static RaceState endlessRace;
+static RaceState rollbackRace;
+static RaceState fourPodRace;
+static float *trafficXs, *trafficZs;
+static volatile float sink;
+
+//----------------------------------------------------------------------------------
+// Module Functions Definition
+//----------------------------------------------------------------------------------
+static double Now(void)
+{
+    struct timespec ts;
+
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static float RandomFloat(uint64_t *state, float min, float max)
+{
+    *state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return min + (max - min) * (float) (*state >> 40) / (float) (1 << 24);
+}
+
+static void BenchCheckCollision(int ops)
+{
+    int hits = 0;
+
+    for (int i = 0; i < ops; ++i)
+        hits += LevelCheckCollision(levels[LEVEL_CITY], points[i % BENCH_N_POINTS], PLAYER_RAD, i);
+    sink = hits;
+}
+
+static void BenchCheckCollisionCarrot(int ops)
+{
+    int hits = 0;
+
+    for (int i = 0; i < ops; ++i)
+        hits += LevelCheckCollision(levels[LEVEL_ICE], points[i % BENCH_N_POINTS], 2, i);
+    sink = hits;
+}
+
+static void BenchSweepCollision(int ops)
+{
+    float toi = 0;
+
+    for (int i = 0; i < ops; ++i)
+        toi += LevelSweepCollision(levels[LEVEL_CITY], points[i % BENCH_N_POINTS], moves[i % BENCH_N_POINTS], PLAYER_RAD).toi;
+    sink = toi;
+}
+
+static void BenchGenerate(LevelArea area, int ops)
+{
+    for (int i = 0; i < ops; ++i)
+    {
+        Level *level = LevelGenerate(area, BENCH_SEED + i);
+        sink = level->map.objs_count;
+        UnloadLevel(level);
+    }
+}
+
+static void BenchGenerateCity(int ops) { BenchGenerate(LEVEL_CITY, ops); }
+static void BenchGenerateForest(int ops) { BenchGenerate(LEVEL_FOREST, ops); }
+static void BenchGenerateLights(int ops) { BenchGenerate(LEVEL_LIGHTS, ops); }
+static void BenchGenerateIce(int ops) { BenchGenerate(LEVEL_ICE, ops); }
+
+static void BenchRespawnCarrot(int ops)
+{
+    Player player = benchPlayer;
+
+    for (int i = 0; i < ops; ++i)
+    {
+        player.pos = points[i % BENCH_N_POINTS];
+        LevelRespawnCarrot(levels[LEVEL_ICE], &player);
+    }
+    sink = player.carrot_pos.x;
+}
+
+// Frames of a single pod, kept as a race of one across calls
+static void BenchSlalom(Level *level, RaceState *race, int ops)
+{
+    for (int i = 0; i < ops; ++i)
+    {
+        // Gentle slalom, the race starts again when it is over
+        PlayerInput input = {1.0f, 1.0f + 0.3f*((race->time_playing[0]/120)%2)};
+        int events;
+
+        UpdateRace(level, race, &input, &events);
+
+        if (events & (SIM_EVENT_GAME_OVER | SIM_EVENT_FINISH))
+            InitRace(level, race, 1);
+    }
+    sink = race->pos_x[0];
+}
+
+static void BenchUpdatePlayer(int ops) { BenchSlalom(levels[LEVEL_CITY], &benchRace, ops); }
+static void BenchUpdatePlayerFixed(int ops) { BenchSlalom(fixedLevel, &fixedBenchRace, ops); }
+static void BenchUpdatePlayerEndless(int ops) { BenchSlalom(endlessLevel, &endlessRace, ops); }
+
+// Streaming of an endless level, each op reaches a chunk never seen and generates it, once the
+// cache is full on the slot of the least recently used one
+static void BenchChunkGenerate(int ops)
+{
+    for (int i = 0; i < ops; ++i)
+    {
+        Vector3 pos = {(float) endlessChunksVisited*CHUNK_SIZE*(2*CHUNK_STREAM_RADIUS + 1) + 1, 0, 1};
+
+        LevelStreamChunks(endlessLevel, pos, 1);
+        endlessChunksVisited++;
+    }
+}
+
+// Split screen race: four pods updated together, compare with 4 times update_player_fixed
+static void BenchRaceFourPods(int ops)
+{
+    for (int i = 0; i < ops; ++i)
+    {
+        PlayerInput inputs[4];
+        int events[4];
+
+        for (int p = 0; p < 4; ++p)
+            inputs[p] = (PlayerInput){1.0f, 1.0f + 0.1f*p + 0.3f*((fourPodRace.time_playing[p]/120)%2)};
+
+        UpdateRace(fixedLevel, &fourPodRace, inputs, events);
+
+        for (int p = 0; p < 4; ++p)
+        {
+            if (events[p] & (SIM_EVENT_GAME_OVER | SIM_EVENT_FINISH))
+            {
+                Player player;
+
+                InitPlayer(fixedLevel, &player);
+                RaceSetPlayer(&fourPodRace, p, &player);
+            }
+        }
+    }
+    sink = fourPodRace.pos_x[3];
+}
+
+// Positions of every moving hazard of the city, as computed once per drawn frame
+static void BenchTrafficPositions(int ops)
+{
+    for (int i = 0; i < ops; ++i)
+        LevelTrafficPositions(levels[LEVEL_CITY], i + 0.5f, trafficXs, trafficZs);
+    sink = trafficXs[0];
+}
+
+static void BenchAutopilotRace(int ops)
+{
+    for (int i = 0; i < ops; ++i)
+    {
+        Player pod = RacePlayer(&autopilotRace, 0);
+        PlayerInput input = AutopilotInput(levels[LEVEL_FOREST], &pod);
+        int events;
+
+        UpdateRace(levels[LEVEL_FOREST], &autopilotRace, &input, &events);
+
+        if (events & (SIM_EVENT_GAME_OVER | SIM_EVENT_FINISH))
+            InitRace(levels[LEVEL_FOREST], &autopilotRace, 1);
+    }
+    sink = autopilotRace.pos_x[0];
+}
+
+// Netplay rollback: restores a two pod race and simulates 8 frames again
+static void BenchRaceRollback(int ops)
+{
+    for (int i = 0; i < ops; ++i)
+    {
+        RaceState race = rollbackRace;
+
+        for (int f = 0; f < 8; ++f)
+        {
+            PlayerInput inputs[2] = {{1.0f, 1.2f}, {1.3f, 1.0f}};
+            UpdateRace(levels[LEVEL_FOREST], &race, inputs, NULL);
+        }
+        sink = race.pos_x[1];
+    }
+}
+
+static void BenchCarrotAngle(int ops)
+{
+    Player player = benchPlayer;
+    float sum = 0;
+
+    for (int i = 0; i < ops; ++i)
+    {
+        player.pos = points[i % BENCH_N_POINTS];
+        sum += CarrotAngle(&player);
+    }
+    sink = sum;
+}
+
+static void BenchCarrotDistance(int ops)
+{
+    Player player = benchPlayer;
+    float sum = 0;
+
+    for (int i = 0; i < ops; ++i)
+    {
+        player.pos = points[i % BENCH_N_POINTS];
+        sum += CarrotDistance(&player);
+    }
+    sink = sum;
+}
+
+static int CompareDoubles(const void *a, const void *b)
+{
+    double da = *(const double *) a;
+    double db = *(const double *) b;
+
+    return (da > db) - (da < db);
+}
+
+static BenchResult RunBenchmark(Benchmark bench)
+{
+    double samples[BENCH_SAMPLES];
+    double total = 0;
+
+    for (int i = 0; i < BENCH_WARMUP_SAMPLES; ++i)
+        bench.run(bench.ops);
+
+    unsigned int allocs = simAllocations;
+
+    for (int i = 0; i < BENCH_SAMPLES; ++i)
+    {
+        double start = Now();
+        bench.run(bench.ops);
+        samples[i] = (Now() - start)*1e9/bench.ops;
+        total += samples[i];
+    }
+
+    allocs = simAllocations - allocs;
+
+    qsort(samples, BENCH_SAMPLES, sizeof(*samples), CompareDoubles);
+
+    BenchResult result = {0};
+    snprintf(result.name, sizeof(result.name), "%s", bench.name);
+    result.ns_per_op = total/BENCH_SAMPLES;
+    result.p50 = samples[BENCH_SAMPLES*50/100];
+    result.p95 = samples[BENCH_SAMPLES*95/100];
+    result.p99 = samples[BENCH_SAMPLES*99/100];
+    result.allocs_per_op = (double) allocs/((double) BENCH_SAMPLES*bench.ops);
+
+    return result;
+}
+
+static void WriteResults(FILE *file, const BenchResult *results, int count)
+{
+    fprintf(file, "{\n  \"benchmarks\": [\n");
+    for (int i = 0; i < count; ++i)
+    {
+        fprintf(file, "    {\"name\": \"%s\", \"ns_per_op\": %.3f, \"p50\": %.3f, \"p95\": %.3f, \"p99\": %.3f, \"allocs_per_op\": %.4f}%s\n",
+                results[i].name, results[i].ns_per_op, results[i].p50, results[i].p95, results[i].p99,
+                results[i].allocs_per_op, (i + 1 < count)? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+}
+
+// Reads a file written by WriteResults, returns the number of results read
+static int ReadResults(const char *path, BenchResult *results, int max_count)
+{
+    FILE *file = fopen(path, "r");
+    char line[512];
+    int count = 0;
+
+    if (!file)
+        return 0;
+
+    while (count < max_count && fgets(line, sizeof(line), file))
+    {
+        BenchResult *r = &results[count];
+
+        if (sscanf(line, " {\"name\": \"%63[^\"]\", \"ns_per_op\": %lf, \"p50\": %lf, \"p95\": %lf, \"p99\": %lf, \"allocs_per_op\": %lf",
+                r->name, &r->ns_per_op, &r->p50, &r->p95, &r->p99, &r->allocs_per_op) == 6)
+            count++;
+    }
+    fclose(file);
+
+    return count;
+}
+
+// Median ratio between the times of two benchmarks. Their samples are taken in turns, so the
+// machine getting slower or faster during the run affects both alike.
+static double RunRatio(Benchmark bench, Benchmark base)
+{
+    double ratios[BENCH_SAMPLES];
+
+    for (int i = 0; i < BENCH_WARMUP_SAMPLES; ++i)
+    {
+        bench.run(bench.ops);
+        base.run(base.ops);
+    }
+
+    for (int i = 0; i < BENCH_SAMPLES; ++i)
+    {
+        double start = Now();
+        bench.run(bench.ops);
+        double middle = Now();
+        base.run(base.ops);
+        double end = Now();
+
+        ratios[i] = ((middle - start)/bench.ops)/((end - middle)/base.ops);
+    }
+
+    qsort(ratios, BENCH_SAMPLES, sizeof(*ratios), CompareDoubles);
+
+    return ratios[BENCH_SAMPLES/2];
+}
+
+//----------------------------------------------------------------------------------
+// Main entry point
+//----------------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+    const char *out_path = NULL;
+    const char *baseline_path = NULL;
+    double tolerance = 0.1;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (!strcmp(argv[i], "--out") && i + 1 < argc)
+            out_path = argv[++i];
+        else if (!strcmp(argv[i], "--baseline") && i + 1 < argc)
+            baseline_path = argv[++i];
+        else if (!strcmp(argv[i], "--tolerance") && i + 1 < argc)
+            tolerance = atof(argv[++i]);
+        else
+        {
+            fprintf(stderr, "usage: %s [--out results.json] [--baseline baseline.json] [--tolerance 0.1]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    SetTraceLogLevel(LOG_WARNING);
+
+    // Fixed inputs for every benchmark
+    for (int i = 0; i < LEVEL_COUNT; ++i)
+        levels[i] = LevelGenerate(i, BENCH_SEED);
+
+    uint64_t rng = BENCH_SEED;
+    for (int i = 0; i < BENCH_N_POINTS; ++i)
+    {
+        points[i] = (Vector3){RandomFloat(&rng, 0, MAP_SIZE_FOREST), 0, RandomFloat(&rng, 0, MAP_SIZE_FOREST)};
+        moves[i] = (Vector3){RandomFloat(&rng, -0.3f, 0.3f), 0, RandomFloat(&rng, -0.3f, 0.3f)};
+    }
+    InitPlayer(levels[LEVEL_CITY], &benchPlayer);
+    InitRace(levels[LEVEL_CITY], &benchRace, 1);
+
+    trafficXs = MemAlloc(sizeof(*trafficXs) * (levels[LEVEL_CITY]->traffic_count + 1));
+    trafficZs = MemAlloc(sizeof(*trafficZs) * (levels[LEVEL_CITY]->traffic_count + 1));
+
+    fixedLevel = LevelGenerate(LEVEL_CITY, BENCH_SEED);
+    fixedLevel->physics_mode = PHYSICS_FIXED;
+    InitRace(fixedLevel, &fixedBenchRace, 1);
+    InitRace(fixedLevel, &fourPodRace, 4);
+    InitRace(levels[LEVEL_FOREST], &autopilotRace, 1);
+
+    endlessLevel = LevelGenerateEndless(LEVEL_FOREST, BENCH_SEED);
+    InitRace(endlessLevel, &endlessRace, 1);
+
+    // A race well after the start, with both pods on the ground
+    InitRace(levels[LEVEL_FOREST], &rollbackRace, 2);
+    for (int f = 0; f < 600; ++f)
+    {
+        Player pod = RacePlayer(&rollbackRace, 0);
+        PlayerInput inputs[2] = {AutopilotInput(levels[LEVEL_FOREST], &pod), {1.0f, 1.0f}};
+        UpdateRace(levels[LEVEL_FOREST], &rollbackRace, inputs, NULL);
+    }
+
+    const Benchmark benchmarks[] = {
+        {"level_check_collision", BenchCheckCollision, 20000},
+        {"level_check_collision_carrot", BenchCheckCollisionCarrot, 20000},
+        {"level_sweep_collision", BenchSweepCollision, 20000},
+        {"level_generate_city", BenchGenerateCity, 2},
+        {"level_generate_forest", BenchGenerateForest, 2},
+        {"level_generate_lights", BenchGenerateLights, 2},
+        {"level_generate_ice", BenchGenerateIce, 2},
+        {"level_respawn_carrot", BenchRespawnCarrot, 1000},
+        {"update_player", BenchUpdatePlayer, 20000},
+        {"update_player_fixed", BenchUpdatePlayerFixed, 20000},
+        {"update_player_endless", BenchUpdatePlayerEndless, 20000},
+        {"race_4_pods", BenchRaceFourPods, 5000},
+        {"traffic_positions", BenchTrafficPositions, 2000},
+        {"chunk_generate", BenchChunkGenerate, 200},
+        {"autopilot_race", BenchAutopilotRace, 2000},
+        {"race_rollback_8_frames", BenchRaceRollback, 2000},
+        {"carrot_angle", BenchCarrotAngle, 20000},
+        {"carrot_distance", BenchCarrotDistance, 20000},
+    };
+    const int count = sizeof(benchmarks)/sizeof(benchmarks[0]);
+
+    BenchResult results[BENCH_MAX_COUNT];
+
+    for (int i = 0; i < count; ++i)
+    {
+        results[i] = RunBenchmark(benchmarks[i]);
+        printf("%-30s %12.1f ns/op  p50 %12.1f  p95 %12.1f  p99 %12.1f  %.4f allocs/op\n", results[i].name,
+                results[i].ns_per_op, results[i].p50, results[i].p95, results[i].p99, results[i].allocs_per_op);
+    }
+
+    if (out_path)
+    {
+        FILE *file = fopen(out_path, "w");
+
+        if (!file)
+        {
+            fprintf(stderr, "Could not write %s\n", out_path);
+            return 2;
+        }
+        WriteResults(file, results, count);
+        fclose(file);
+    }
+
+    int regressions = 0;
+
+    if (baseline_path)
+    {
+        BenchResult baseline[BENCH_MAX_COUNT];
+        int baseline_count = ReadResults(baseline_path, baseline, BENCH_MAX_COUNT);
+
+        if (baseline_count == 0)
+            printf("No baseline found at %s\n", baseline_path);
+
+        for (int i = 0; i < count; ++i)
+        {
+            for (int j = 0; j < baseline_count; ++j)
+            {
+                if (strcmp(results[i].name, baseline[j].name))
+                    continue;
+
+                double ratio = results[i].p50/baseline[j].p50;
+
+                if (ratio > 1 + tolerance || results[i].allocs_per_op > baseline[j].allocs_per_op)
+                {
+                    printf("REGRESSION %s: p50 %.1f ns -> %.1f ns (%+.1f%%), allocs/op %.4f -> %.4f\n", results[i].name,
+                            baseline[j].p50, results[i].p50, 100*(ratio - 1), baseline[j].allocs_per_op, results[i].allocs_per_op);
+                    regressions++;
+                }
+            }
+        }
+    }
+
+    // Fixed-point physics must be at least as fast as the float ones, with or without a baseline
+    double fixed_ratio = RunRatio((Benchmark){"update_player_fixed", BenchUpdatePlayerFixed, 20000},
+            (Benchmark){"update_player", BenchUpdatePlayer, 20000});
+
+    printf("update_player_fixed / update_player: %.3f\n", fixed_ratio);
+    if (fixed_ratio > 1)
+    {
+        printf("REGRESSION update_player_fixed: %.1f%% slower than update_player\n", 100*(fixed_ratio - 1));
+        regressions++;
+    }
+
+    for (int i = 0; i < LEVEL_COUNT; ++i)
+        UnloadLevel(levels[i]);
+    UnloadLevel(fixedLevel);
+    UnloadLevel(endlessLevel);
+    MemFree(trafficXs);
+    MemFree(trafficZs);
+
+    return regressions ? 1 : 0;
+}
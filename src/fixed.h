@@ -0,0 +1,162 @@
+/*******************************************************************************************
+*
+*   Nokia Pod Racer
+*   Fixed-point math for the deterministic physics mode.
+*
+*   Values are 16.16 fixed point and angles are binary angles (1/2^32 turns, so they wrap around
+*   by themselves). Only integer operations are used, so the results are bit-exact with any
+*   compiler, optimization level and platform, including the web build.
+*
+*   Copyright (c) 2023 Francisco Casas (@autopawn)
+*
+********************************************************************************************/
+
+#ifndef FIXED_H
+#define FIXED_H
+
+#include <stdint.h>
+#include <math.h>
+
+//----------------------------------------------------------------------------------
+// Types and Structures Definition
+//----------------------------------------------------------------------------------
+typedef int32_t Fixed;          // 16.16 fixed point
+
+typedef struct
+{
+    Fixed x, y, z;
+} FixedVector3;
+
+//----------------------------------------------------------------------------------
+// Fixed-point constants
+//----------------------------------------------------------------------------------
+#define FIXED_ONE 65536
+
+// sin(i*PI/512)*FIXED_ONE, a quarter turn, the rest is interpolated and mirrored from it
+static const int32_t FIXED_SIN_TABLE[257] = {
+    0, 402, 804, 1206, 1608, 2010, 2412, 2814, 3216, 3617, 4019, 4420,
+    4821, 5222, 5623, 6023, 6424, 6824, 7224, 7623, 8022, 8421, 8820, 9218,
+    9616, 10014, 10411, 10808, 11204, 11600, 11996, 12391, 12785, 13180, 13573, 13966,
+    14359, 14751, 15143, 15534, 15924, 16314, 16703, 17091, 17479, 17867, 18253, 18639,
+    19024, 19409, 19792, 20175, 20557, 20939, 21320, 21699, 22078, 22457, 22834, 23210,
+    23586, 23961, 24335, 24708, 25080, 25451, 25821, 26190, 26558, 26925, 27291, 27656,
+    28020, 28383, 28745, 29106, 29466, 29824, 30182, 30538, 30893, 31248, 31600, 31952,
+    32303, 32652, 33000, 33347, 33692, 34037, 34380, 34721, 35062, 35401, 35738, 36075,
+    36410, 36744, 37076, 37407, 37736, 38064, 38391, 38716, 39040, 39362, 39683, 40002,
+    40320, 40636, 40951, 41264, 41576, 41886, 42194, 42501, 42806, 43110, 43412, 43713,
+    44011, 44308, 44604, 44898, 45190, 45480, 45769, 46056, 46341, 46624, 46906, 47186,
+    47464, 47741, 48015, 48288, 48559, 48828, 49095, 49361, 49624, 49886, 50146, 50404,
+    50660, 50914, 51166, 51417, 51665, 51911, 52156, 52398, 52639, 52878, 53114, 53349,
+    53581, 53812, 54040, 54267, 54491, 54714, 54934, 55152, 55368, 55582, 55794, 56004,
+    56212, 56418, 56621, 56823, 57022, 57219, 57414, 57607, 57798, 57986, 58172, 58356,
+    58538, 58718, 58896, 59071, 59244, 59415, 59583, 59750, 59914, 60075, 60235, 60392,
+    60547, 60700, 60851, 60999, 61145, 61288, 61429, 61568, 61705, 61839, 61971, 62101,
+    62228, 62353, 62476, 62596, 62714, 62830, 62943, 63054, 63162, 63268, 63372, 63473,
+    63572, 63668, 63763, 63854, 63944, 64031, 64115, 64197, 64277, 64354, 64429, 64501,
+    64571, 64639, 64704, 64766, 64827, 64884, 64940, 64993, 65043, 65091, 65137, 65180,
+    65220, 65259, 65294, 65328, 65358, 65387, 65413, 65436, 65457, 65476, 65492, 65505,
+    65516, 65525, 65531, 65535, 65536,
+};
+
+//----------------------------------------------------------------------------------
+// Fixed-point functions
+//----------------------------------------------------------------------------------
+
+// Float conversions are exact for the constants and quantized inputs fed to the physics.
+// Rounds half away from zero like lroundf, but inline: the physics converts its constants, the
+// controls and the carrot every frame, and the library call cost more than the rest of a step.
+// value*FIXED_ONE and adding 0.5 in double are both exact, so the result is the same.
+static inline Fixed FixedFromFloat(float value)
+{
+    double scaled = (double) value*FIXED_ONE;
+
+    return (Fixed) ((scaled < 0)? scaled - 0.5 : scaled + 0.5);
+}
+
+static inline float FixedToFloat(Fixed value)
+{
+    return (float) value/FIXED_ONE;
+}
+
+static inline Fixed FixedMul(Fixed a, Fixed b)
+{
+    return (Fixed) (((int64_t) a*b)/FIXED_ONE);
+}
+
+static inline Fixed FixedAbs(Fixed a)
+{
+    return a < 0 ? -a : a;
+}
+
+// a*(1 - t) + b*t, with t in fixed point
+static inline Fixed FixedLerp(Fixed a, Fixed b, Fixed t)
+{
+    return (Fixed) (((int64_t) a*(FIXED_ONE - t) + (int64_t) b*t)/FIXED_ONE);
+}
+
+static inline FixedVector3 FixedVector3Add(FixedVector3 a, FixedVector3 b)
+{
+    return (FixedVector3){a.x + b.x, a.y + b.y, a.z + b.z};
+}
+
+static inline FixedVector3 FixedVector3Subtract(FixedVector3 a, FixedVector3 b)
+{
+    return (FixedVector3){a.x - b.x, a.y - b.y, a.z - b.z};
+}
+
+static inline FixedVector3 FixedVector3Scale(FixedVector3 v, Fixed scale)
+{
+    return (FixedVector3){FixedMul(v.x, scale), FixedMul(v.y, scale), FixedMul(v.z, scale)};
+}
+
+// Dot product, in 32.32 fixed point
+static inline int64_t FixedDot(FixedVector3 a, FixedVector3 b)
+{
+    return (int64_t) a.x*b.x + (int64_t) a.y*b.y + (int64_t) a.z*b.z;
+}
+
+// Largest integer whose square is at most value
+static inline uint64_t FixedIntSqrt(uint64_t value)
+{
+    uint64_t root = 0;
+    uint64_t bit = (uint64_t) 1 << 62;
+
+    while (bit > value)
+        bit >>= 2;
+
+    while (bit)
+    {
+        if (value >= root + bit)
+        {
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else
+            root >>= 1;
+        bit >>= 2;
+    }
+    return root;
+}
+
+// Sine of a binary angle, interpolated from the table
+static inline Fixed FixedSin(uint32_t ang)
+{
+    uint32_t quarter = ang >> 30;
+    uint32_t pos = (ang >> 6) & 0xffffff;       // Position in the quarter, in 1/2^24 quarters
+
+    if (quarter & 1)
+        pos = 0xffffff - pos;
+
+    int i = pos >> 16;
+    int32_t frac = pos & 0xffff;
+    Fixed value = FIXED_SIN_TABLE[i] + ((FIXED_SIN_TABLE[i + 1] - FIXED_SIN_TABLE[i])*frac)/FIXED_ONE;
+
+    return (quarter & 2) ? -value : value;
+}
+
+static inline Fixed FixedCos(uint32_t ang)
+{
+    return FixedSin(ang + 0x40000000u);
+}
+
+#endif // FIXED_H
@@ -0,0 +1,193 @@
+/*******************************************************************************************
+*
+*   Nokia Pod Racer
+*   Ghosts: the trajectory of a race, to race against it later on the same level.
+*
+*   File layout, little endian: "NPG1", area (u8), sample frames (u8), seed (u64), samples
+*   count (u32) and then the samples, as x, y, z and angle (u16 each). Samples are written in
+*   race order, so the file can be read as a stream.
+*
+*   Copyright (c) 2023 Francisco Casas (@autopawn)
+*
+********************************************************************************************/
+
+#include "raylib.h"
+#include "raymath.h"
+#include "ghost.h"
+
+#include <math.h>
+#include <string.h>
+
+#define GHOST_HEADER_SIZE 18
+#define GHOST_SAMPLE_SIZE 8
+
+//----------------------------------------------------------------------------------
+// Module Functions Definition
+//----------------------------------------------------------------------------------
+
+static int16_t QuantizePosition(float value)
+{
+    return (int16_t) roundf(Clamp(value*GHOST_POS_QUANT, INT16_MIN, INT16_MAX));
+}
+
+static uint16_t QuantizeAngle(float ang)
+{
+    float turns = ang/(2*PI);
+
+    return (uint16_t) (int) roundf((turns - floorf(turns))*65536);
+}
+
+static void PutU16(uint8_t *bytes, uint16_t value)
+{
+    bytes[0] = value;
+    bytes[1] = value >> 8;
+}
+
+static uint16_t GetU16(const uint8_t *bytes)
+{
+    return bytes[0] | (uint16_t) bytes[1] << 8;
+}
+
+static void PutU32(uint8_t *bytes, uint32_t value)
+{
+    PutU16(bytes, value);
+    PutU16(bytes + 2, value >> 16);
+}
+
+static uint32_t GetU32(const uint8_t *bytes)
+{
+    return GetU16(bytes) | (uint32_t) GetU16(bytes + 2) << 16;
+}
+
+static void GhostReserve(Ghost *ghost, int capacity)
+{
+    if (ghost->samples_capacity >= capacity)
+        return;
+
+    ghost->samples = MemRealloc(ghost->samples, capacity*sizeof(*ghost->samples));
+    ghost->samples_capacity = capacity;
+}
+
+// Starts an empty ghost. The ghost must be zeroed or hold a previous one, whose buffer is reused.
+void InitGhost(Ghost *ghost, LevelArea area, uint64_t seed)
+{
+    ghost->area = area;
+    ghost->seed = seed;
+    ghost->samples_count = 0;
+
+    GhostReserve(ghost, GHOST_RESERVED_SAMPLES);
+}
+
+void UnloadGhost(Ghost *ghost)
+{
+    MemFree(ghost->samples);
+    *ghost = (Ghost){0};
+}
+
+// Records the pod after the given frame of the race, counted from 0
+void GhostRecord(Ghost *ghost, int frame, const Player *player)
+{
+    if (frame % GHOST_SAMPLE_FRAMES != 0 || frame/GHOST_SAMPLE_FRAMES != ghost->samples_count)
+        return;
+
+    if (ghost->samples_count == ghost->samples_capacity)
+        GhostReserve(ghost, 2*ghost->samples_capacity);
+
+    ghost->samples[ghost->samples_count++] = (GhostSample){
+        QuantizePosition(player->pos.x),
+        QuantizePosition(player->pos.y),
+        QuantizePosition(player->pos.z),
+        QuantizeAngle(player->ang),
+    };
+}
+
+bool SaveGhost(const Ghost *ghost, const char *fileName)
+{
+    int size = GHOST_HEADER_SIZE + GHOST_SAMPLE_SIZE*ghost->samples_count;
+    uint8_t *bytes = MemAlloc(size);
+
+    memcpy(bytes, "NPG1", 4);
+    bytes[4] = ghost->area;
+    bytes[5] = GHOST_SAMPLE_FRAMES;
+    PutU32(bytes + 6, ghost->seed);
+    PutU32(bytes + 10, ghost->seed >> 32);
+    PutU32(bytes + 14, ghost->samples_count);
+
+    for (int i = 0; i < ghost->samples_count; ++i)
+    {
+        uint8_t *sample = bytes + GHOST_HEADER_SIZE + GHOST_SAMPLE_SIZE*i;
+
+        PutU16(sample, ghost->samples[i].x);
+        PutU16(sample + 2, ghost->samples[i].y);
+        PutU16(sample + 4, ghost->samples[i].z);
+        PutU16(sample + 6, ghost->samples[i].ang);
+    }
+
+    bool success = SaveFileData(fileName, bytes, size);
+    MemFree(bytes);
+
+    return success;
+}
+
+bool LoadGhost(Ghost *ghost, const char *fileName)
+{
+    unsigned int size = 0;
+    uint8_t *bytes = LoadFileData(fileName, &size);
+
+    if (!bytes)
+        return false;
+
+    bool valid = size >= GHOST_HEADER_SIZE && !memcmp(bytes, "NPG1", 4) && bytes[4] < LEVEL_COUNT &&
+            bytes[5] == GHOST_SAMPLE_FRAMES && GetU32(bytes + 14) == (size - GHOST_HEADER_SIZE)/GHOST_SAMPLE_SIZE &&
+            (size - GHOST_HEADER_SIZE) % GHOST_SAMPLE_SIZE == 0;
+
+    if (valid)
+    {
+        int count = GetU32(bytes + 14);
+
+        InitGhost(ghost, bytes[4], GetU32(bytes + 6) | (uint64_t) GetU32(bytes + 10) << 32);
+        GhostReserve(ghost, count);
+
+        for (int i = 0; i < count; ++i)
+        {
+            const uint8_t *sample = bytes + GHOST_HEADER_SIZE + GHOST_SAMPLE_SIZE*i;
+
+            ghost->samples[i] = (GhostSample){
+                (int16_t) GetU16(sample), (int16_t) GetU16(sample + 2), (int16_t) GetU16(sample + 4),
+                GetU16(sample + 6),
+            };
+        }
+        ghost->samples_count = count;
+    }
+
+    UnloadFileData(bytes);
+
+    return valid;
+}
+
+// Pose of the ghost after the given frame of the race, which may be between two frames,
+// interpolated between samples. Returns false once the ghost race is over.
+bool GhostPose(const Ghost *ghost, float frame, Vector3 *pos, float *ang)
+{
+    if (frame < 0)
+        return false;
+
+    int i = (int) (frame/GHOST_SAMPLE_FRAMES);
+
+    if (i + 1 >= ghost->samples_count)
+        return false;
+
+    const GhostSample *a = &ghost->samples[i];
+    const GhostSample *b = &ghost->samples[i + 1];
+    float t = frame/GHOST_SAMPLE_FRAMES - i;
+
+    pos->x = Lerp(a->x, b->x, t)/GHOST_POS_QUANT;
+    pos->y = Lerp(a->y, b->y, t)/GHOST_POS_QUANT;
+    pos->z = Lerp(a->z, b->z, t)/GHOST_POS_QUANT;
+
+    // Turn the short way around
+    int16_t turn = (int16_t) (uint16_t) (b->ang - a->ang);
+    *ang = (a->ang + t*turn)/65536.0f*2*PI;
+
+    return true;
+}
@@ -0,0 +1,67 @@
+/*******************************************************************************************
+*
+*   Nokia Pod Racer
+*   Ghosts: the trajectory of a race, to race against it later on the same level.
+*
+*   The pod position and angle are sampled every GHOST_SAMPLE_FRAMES and quantized to 16 bits
+*   each, the pose between samples is interpolated. A ghost keeps the level seed, so the level
+*   can be generated again exactly as it was raced.
+*
+*   Copyright (c) 2023 Francisco Casas (@autopawn)
+*
+********************************************************************************************/
+
+#ifndef GHOST_H
+#define GHOST_H
+
+#include "simulation.h"
+
+#include <stdint.h>
+
+//----------------------------------------------------------------------------------
+// Ghost constants
+//----------------------------------------------------------------------------------
+static const int GHOST_SAMPLE_FRAMES = 4;
+static const int GHOST_POS_QUANT = 64;              // Positions go from -512 to 512 units
+static const int GHOST_RESERVED_SAMPLES = 4096;     // Over 4 minutes, races rarely need to grow it
+
+//----------------------------------------------------------------------------------
+// Types and Structures Definition
+//----------------------------------------------------------------------------------
+typedef struct
+{
+    int16_t x, y, z;        // Position, in 1/GHOST_POS_QUANT units
+    uint16_t ang;           // Angle, in 1/65536 turns
+} GhostSample;
+
+typedef struct
+{
+    LevelArea area;
+    uint64_t seed;
+
+    GhostSample *samples;   // samples[i] is the pod after frame i*GHOST_SAMPLE_FRAMES
+    int samples_count, samples_capacity;
+} Ghost;
+
+#ifdef __cplusplus
+extern "C" {            // Prevents name mangling of functions
+#endif
+
+//----------------------------------------------------------------------------------
+// Ghost Functions Declaration
+//----------------------------------------------------------------------------------
+void InitGhost(Ghost *ghost, LevelArea area, uint64_t seed);
+void UnloadGhost(Ghost *ghost);
+
+void GhostRecord(Ghost *ghost, int frame, const Player *player);
+
+bool SaveGhost(const Ghost *ghost, const char *fileName);
+bool LoadGhost(Ghost *ghost, const char *fileName);
+
+bool GhostPose(const Ghost *ghost, float frame, Vector3 *pos, float *ang);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // GHOST_H
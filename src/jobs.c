@@ -0,0 +1,138 @@
+/*******************************************************************************************
+*
+*   Nokia Pod Racer
+*   Job pool: runs many independent jobs over all the cores, for the headless tools.
+*
+*   Copyright (c) 2023 Francisco Casas (@autopawn)
+*
+********************************************************************************************/
+
+#include "jobs.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+//----------------------------------------------------------------------------------
+// Types and Structures Definition
+//----------------------------------------------------------------------------------
+
+// Jobs first .. last - 1 are still pending. The owner takes them from the front, thieves from
+// the back.
+typedef struct
+{
+    pthread_mutex_t lock;
+    int first, last;
+} JobQueue;
+
+typedef struct
+{
+    JobFunc func;
+    void *data;
+    JobQueue *queues;
+    int workers;
+} JobPool;
+
+typedef struct
+{
+    JobPool *pool;
+    int worker;
+} JobWorker;
+
+//----------------------------------------------------------------------------------
+// Module Functions Definition
+//----------------------------------------------------------------------------------
+
+static int JobQueuePopFront(JobQueue *queue)
+{
+    int job = -1;
+
+    pthread_mutex_lock(&queue->lock);
+    if (queue->first < queue->last)
+        job = queue->first++;
+    pthread_mutex_unlock(&queue->lock);
+
+    return job;
+}
+
+static int JobQueuePopBack(JobQueue *queue)
+{
+    int job = -1;
+
+    pthread_mutex_lock(&queue->lock);
+    if (queue->first < queue->last)
+        job = --queue->last;
+    pthread_mutex_unlock(&queue->lock);
+
+    return job;
+}
+
+static void *JobWorkerRun(void *arg)
+{
+    JobWorker *worker = arg;
+    JobPool *pool = worker->pool;
+
+    while (true)
+    {
+        int job = JobQueuePopFront(&pool->queues[worker->worker]);
+
+        // Steal, starting by the next worker so thieves don't all go for the same queue
+        for (int i = 1; job < 0 && i < pool->workers; ++i)
+            job = JobQueuePopBack(&pool->queues[(worker->worker + i) % pool->workers]);
+
+        // Jobs are never added, so if every queue is empty we are done
+        if (job < 0)
+            break;
+
+        pool->func(pool->data, job, worker->worker);
+    }
+
+    return NULL;
+}
+
+int GetCoreCount(void)
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return (count < 1)? 1 : (int) count;
+}
+
+// Runs func for every job from 0 to count - 1 using the given number of worker threads and
+// waits for all of them to finish. The calling thread is worker 0.
+void RunJobs(JobFunc func, void *data, int count, int workers)
+{
+    if (workers < 1)
+        workers = 1;
+    if (workers > count)
+        workers = (count > 0)? count : 1;
+
+    JobPool pool = { func, data, calloc(workers, sizeof(JobQueue)), workers };
+    JobWorker *workerArgs = calloc(workers, sizeof(JobWorker));
+    pthread_t *threads = calloc(workers, sizeof(pthread_t));
+
+    for (int i = 0; i < workers; ++i)
+    {
+        pthread_mutex_init(&pool.queues[i].lock, NULL);
+        pool.queues[i].first = (int) ((long long) count*i/workers);
+        pool.queues[i].last = (int) ((long long) count*(i + 1)/workers);
+
+        workerArgs[i].pool = &pool;
+        workerArgs[i].worker = i;
+    }
+
+    for (int i = 1; i < workers; ++i)
+        pthread_create(&threads[i], NULL, JobWorkerRun, &workerArgs[i]);
+
+    JobWorkerRun(&workerArgs[0]);
+
+    for (int i = 1; i < workers; ++i)
+        pthread_join(threads[i], NULL);
+
+    for (int i = 0; i < workers; ++i)
+        pthread_mutex_destroy(&pool.queues[i].lock);
+
+    free(threads);
+    free(workerArgs);
+    free(pool.queues);
+}
@@ -0,0 +1,37 @@
+/*******************************************************************************************
+*
+*   Nokia Pod Racer
+*   Job pool: runs many independent jobs over all the cores, for the headless tools.
+*
+*   Jobs are split evenly between the workers at the start. A worker that runs out of jobs
+*   steals from the end of the queue of another one, so uneven jobs still keep every core busy.
+*
+*   Copyright (c) 2023 Francisco Casas (@autopawn)
+*
+********************************************************************************************/
+
+#ifndef JOBS_H
+#define JOBS_H
+
+//----------------------------------------------------------------------------------
+// Types and Structures Definition
+//----------------------------------------------------------------------------------
+
+// Runs job number job (0 <= job < count) on worker number worker (0 <= worker < workers)
+typedef void (*JobFunc)(void *data, int job, int worker);
+
+#ifdef __cplusplus
+extern "C" {            // Prevents name mangling of functions
+#endif
+
+//----------------------------------------------------------------------------------
+// Job Pool Functions Declaration
+//----------------------------------------------------------------------------------
+int GetCoreCount(void);
+void RunJobs(JobFunc func, void *data, int count, int workers);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // JOBS_H
@@ -0,0 +1,241 @@
+/*******************************************************************************************
+*
+*   Nokia Pod Racer
+*   Netplay checker: races two games against each other over loopback UDP, driven by the
+*   autopilot, with simulated latency and packet loss, and checks that both see the same race.
+*
+*   Each game runs on its own thread at the game frame rate, the second one starts a bit later.
+*   Once the controls of a frame are known by a game, the race it has at that frame is final,
+*   its checksum must match the one of the other game.
+*
+*   Usage: netcheck [--area city|forest|lights|ice] [--frames 1200] [--latency-ms 50]
+*                   [--loss 0.1] [--port 7351]
+*
+*   Copyright (c) 2023 Francisco Casas (@autopawn)
+*
+********************************************************************************************/
+
+#include "raylib.h"
+#include "netplay.h"
+#include "autopilot.h"
+#include "replay.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define NETCHECK_FRAME_TIME (1.0/60)
+#define NETCHECK_START_DELAY 0.1
+#define NETCHECK_TIMEOUT 30.0
+
+//----------------------------------------------------------------------------------
+// Types and Structures Definition
+//----------------------------------------------------------------------------------
+typedef struct
+{
+    Level *level;
+    int port, rival_port;
+    int frames;
+    double start_delay;
+    double latency;
+    float loss;
+
+    Netplay net;
+
+    uint32_t *checksums;        // checksums[f] is the race before frame f, once it is final
+    int checked;                // Frames with a final checksum
+
+    int stalls;                 // Frames waiting for the rival
+    double worst_update;        // Seconds
+    bool ok;
+} Game;
+
+//----------------------------------------------------------------------------------
+// Module Functions Definition
+//----------------------------------------------------------------------------------
+static double Now(void)
+{
+    struct timespec ts;
+
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static void SleepUntil(double time)
+{
+    double wait = time - Now();
+
+    if (wait > 0)
+    {
+        struct timespec ts = {(time_t) wait, (long) ((wait - (time_t) wait)*1e9)};
+        nanosleep(&ts, NULL);
+    }
+}
+
+static uint32_t RaceChecksum(const RaceState *race)
+{
+    uint32_t hash = race->frame;
+
+    for (int i = 0; i < race->players_count; ++i)
+    {
+        Player player = RacePlayer(race, i);
+        hash = hash*16777619u ^ PlayerChecksum(&player);
+    }
+    return hash;
+}
+
+// Takes the checksums of the frames that became final
+static void GameCheckFrames(Game *game)
+{
+    const Netplay *net = &game->net;
+    int confirmed = NetplayConfirmedFrames(net);
+
+    for (; game->checked < confirmed && game->checked <= game->frames; ++game->checked)
+        game->checksums[game->checked] = RaceChecksum(&net->snapshots[game->checked % NETPLAY_HISTORY]);
+}
+
+static void *RunGame(void *arg)
+{
+    Game *game = arg;
+    Level *level = game->level;
+
+    game->ok = InitNetplay(&game->net, level, game->port, game->rival_port);
+    if (!game->ok)
+        return NULL;
+    NetplaySetConditions(&game->net, game->latency, game->loss);
+
+    SleepUntil(Now() + game->start_delay);
+
+    double start = Now();
+    double next_frame = start;
+
+    // Go on until every frame checked is final
+    while (game->checked <= game->frames && Now() - start < NETCHECK_TIMEOUT)
+    {
+        Netplay *net = &game->net;
+        Player pod = RacePlayer(&net->race, net->local);
+        PlayerInput input = AutopilotInput(level, &pod);
+        int events;
+
+        double update_start = Now();
+        if (!NetplayUpdate(net, input, &events))
+            game->stalls++;
+        double update_time = Now() - update_start;
+
+        if (update_time > game->worst_update)
+            game->worst_update = update_time;
+
+        GameCheckFrames(game);
+
+        next_frame += NETCHECK_FRAME_TIME;
+        SleepUntil(next_frame);
+    }
+
+    game->ok = game->checked > game->frames;
+
+    return NULL;
+}
+
+//----------------------------------------------------------------------------------
+// Main entry point
+//----------------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+    const char *areaNames[LEVEL_COUNT] = { "city", "forest", "lights", "ice" };
+
+    Game games[2] = {0};
+    LevelArea area = LEVEL_CITY;
+    int frames = 1200;
+    double latency = 0.05;
+    float loss = 0.1f;
+    int port = 7351;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (!strcmp(argv[i], "--area") && i + 1 < argc)
+        {
+            ++i;
+            for (int j = 0; j < LEVEL_COUNT; ++j)
+            {
+                if (!strcmp(argv[i], areaNames[j]))
+                    area = j;
+            }
+        }
+        else if (!strcmp(argv[i], "--frames") && i + 1 < argc)
+            frames = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--latency-ms") && i + 1 < argc)
+            latency = atof(argv[++i])/1000;
+        else if (!strcmp(argv[i], "--loss") && i + 1 < argc)
+            loss = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--port") && i + 1 < argc)
+            port = atoi(argv[++i]);
+        else
+        {
+            fprintf(stderr, "usage: %s [--area city|forest|lights|ice] [--frames 1200] [--latency-ms 50]\n"
+                    "    [--loss 0.1] [--port 7351]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    SetTraceLogLevel(LOG_WARNING);
+
+    // Each game generates its own level, as two separate games would, with the physics of the game
+    pthread_t threads[2];
+
+    for (int i = 0; i < 2; ++i)
+    {
+        games[i].level = LevelGenerate(area, NETPLAY_SEED);
+        games[i].level->physics_mode = PHYSICS_FIXED;
+        games[i].port = port + i;
+        games[i].rival_port = port + 1 - i;
+        games[i].frames = frames;
+        games[i].start_delay = i*NETCHECK_START_DELAY;
+        games[i].latency = latency;
+        games[i].loss = loss;
+        games[i].checksums = calloc(frames + 1, sizeof(*games[i].checksums));
+
+        pthread_create(&threads[i], NULL, RunGame, &games[i]);
+    }
+
+    for (int i = 0; i < 2; ++i)
+        pthread_join(threads[i], NULL);
+
+    int mismatch = -1;
+
+    for (int f = 0; f <= frames && mismatch < 0; ++f)
+    {
+        if (games[0].checksums[f] != games[1].checksums[f])
+            mismatch = f;
+    }
+
+    printf("%s, %d frames, %.0f ms latency, %.0f%% loss\n", areaNames[area], frames, latency*1000, loss*100);
+
+    for (int i = 0; i < 2; ++i)
+    {
+        const Game *game = &games[i];
+
+        printf("game %d: %s, %d rollbacks, %d frames simulated again (max %d at once), %d frames waiting, "
+                "worst update %.3f ms\n", i, game->ok ? "done" : "FAILED", game->net.rollbacks,
+                game->net.resimulated_frames, game->net.max_rollback, game->stalls, game->worst_update*1000);
+    }
+
+    bool ok = games[0].ok && games[1].ok && mismatch < 0;
+
+    if (mismatch >= 0)
+        printf("Races differ at frame %d\n", mismatch);
+    else if (ok)
+        printf("Races match\n");
+
+    // The games leave once both are done, so neither takes the other as gone
+    for (int i = 0; i < 2; ++i)
+    {
+        if (games[i].net.level)
+            CloseNetplay(&games[i].net);
+        UnloadLevel(games[i].level);
+        free(games[i].checksums);
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,337 @@
+/*******************************************************************************************
+*
+*   Nokia Pod Racer
+*   Netplay: head-to-head races between two games on the same machine, over UDP.
+*
+*   Packet layout, little endian: "NPN1", area (u8), flags (u8), seed (u64), frames of rival
+*   controls received (u32), first frame sent (u32), frames sent (u8) and then the controls of
+*   each frame, as turbo_l and turbo_r steps (u8 each).
+*
+*   Copyright (c) 2023 Francisco Casas (@autopawn)
+*
+********************************************************************************************/
+
+#include "raylib.h"
+#include "netplay.h"
+#include "replay.h"
+#include "udp.h"
+
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+#define NETPLAY_HEADER_SIZE 23
+#define NETPLAY_BYE_PACKETS 5
+
+typedef enum
+{
+    NETPLAY_FLAG_BYE = 1 << 0,      // The game left the race
+} NetplayFlag;
+
+//----------------------------------------------------------------------------------
+// Module Functions Definition
+//----------------------------------------------------------------------------------
+
+static double Now(void)
+{
+    struct timespec ts;
+
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static float RandomUnit(uint64_t *state)
+{
+    *state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (float) (*state >> 40) / (float) (1 << 24);
+}
+
+static void PutU32(uint8_t *bytes, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i)
+        bytes[i] = value >> (8*i);
+}
+
+static uint32_t GetU32(const uint8_t *bytes)
+{
+    uint32_t value = 0;
+
+    for (int i = 0; i < 4; ++i)
+        value |= (uint32_t) bytes[i] << (8*i);
+    return value;
+}
+
+// Controls are sent in steps, as the replays store them, so both games simulate the same values
+static uint8_t TurboSteps(float turbo)
+{
+    return (uint8_t) roundf(turbo*REPLAY_TURBO_STEPS);
+}
+
+static float TurboValue(uint8_t steps)
+{
+    return (float) steps/REPLAY_TURBO_STEPS;
+}
+
+static bool SameInput(PlayerInput a, PlayerInput b)
+{
+    return a.turbo_l == b.turbo_l && a.turbo_r == b.turbo_r;
+}
+
+// Rival controls for the given frame, the last ones received if it's not known yet
+static PlayerInput RemoteInput(const Netplay *net, int frame)
+{
+    if (frame < net->remote_frames)
+        return net->inputs[frame % NETPLAY_HISTORY][net->remote];
+    if (net->remote_frames == 0)
+        return (PlayerInput){0};
+    return net->inputs[(net->remote_frames - 1) % NETPLAY_HISTORY][net->remote];
+}
+
+static void NetplaySendRaw(Netplay *net, const uint8_t *data, int size)
+{
+    if (net->loss > 0 && RandomUnit(&net->rng) < net->loss)
+        return;
+
+    if (net->latency <= 0)
+    {
+        UdpSend(net->socket, net->remote_port, data, size);
+        return;
+    }
+
+    // A quarter of jitter, so packets may also arrive out of order
+    if (net->delayed_count < NETPLAY_DELAYED_PACKETS)
+    {
+        NetplayPacket *packet = &net->delayed[net->delayed_count++];
+
+        packet->send_time = Now() + net->latency*(0.75 + 0.5*RandomUnit(&net->rng));
+        packet->size = size;
+        memcpy(packet->data, data, size);
+    }
+}
+
+static void NetplaySendDelayed(Netplay *net)
+{
+    double now = Now();
+
+    for (int i = 0; i < net->delayed_count; ++i)
+    {
+        if (net->delayed[i].send_time <= now)
+        {
+            UdpSend(net->socket, net->remote_port, net->delayed[i].data, net->delayed[i].size);
+            net->delayed[i--] = net->delayed[--net->delayed_count];
+        }
+    }
+}
+
+// Sends every local control the rival has not received yet
+static void NetplaySend(Netplay *net, int flags)
+{
+    uint8_t data[NETPLAY_PACKET_SIZE];
+
+    int first = net->acked_frames;
+    int count = net->race.frame - first;
+
+    if (count > NETPLAY_HISTORY/2)
+        count = NETPLAY_HISTORY/2;
+
+    memcpy(data, "NPN1", 4);
+    data[4] = net->level->area;
+    data[5] = flags;
+    PutU32(data + 6, net->level->seed);
+    PutU32(data + 10, net->level->seed >> 32);
+    PutU32(data + 14, net->remote_frames);
+    PutU32(data + 18, first);
+    data[22] = count;
+
+    for (int i = 0; i < count; ++i)
+    {
+        PlayerInput input = net->inputs[(first + i) % NETPLAY_HISTORY][net->local];
+
+        data[NETPLAY_HEADER_SIZE + 2*i] = TurboSteps(input.turbo_l);
+        data[NETPLAY_HEADER_SIZE + 2*i + 1] = TurboSteps(input.turbo_r);
+    }
+
+    NetplaySendRaw(net, data, NETPLAY_HEADER_SIZE + 2*count);
+    NetplaySendDelayed(net);
+}
+
+// Reads a packet from the rival, returns the first simulated frame whose rival controls were
+// mispredicted, or -1
+static int NetplayReceive(Netplay *net, const uint8_t *data, int size)
+{
+    if (size < NETPLAY_HEADER_SIZE || memcmp(data, "NPN1", 4) || data[4] != net->level->area ||
+            (GetU32(data + 6) | (uint64_t) GetU32(data + 10) << 32) != net->level->seed ||
+            size != NETPLAY_HEADER_SIZE + 2*data[22])
+        return -1;
+
+    net->last_receive = Now();
+
+    if (data[5] & NETPLAY_FLAG_BYE)
+        net->remote_gone = true;
+
+    int acked = GetU32(data + 14);
+    if (acked > net->acked_frames && acked <= net->race.frame)
+        net->acked_frames = acked;
+
+    int first = GetU32(data + 18);
+    int count = data[22];
+    int mispredicted = -1;
+
+    for (int i = 0; i < count; ++i)
+    {
+        int frame = first + i;
+
+        // Only take them in order, and not so far ahead that they would overwrite live entries
+        if (frame < net->remote_frames)
+            continue;
+        if (frame > net->remote_frames || frame >= net->race.frame + NETPLAY_HISTORY/2)
+            break;
+
+        PlayerInput input = {TurboValue(data[NETPLAY_HEADER_SIZE + 2*i]), TurboValue(data[NETPLAY_HEADER_SIZE + 2*i + 1])};
+        PlayerInput *used = &net->inputs[frame % NETPLAY_HISTORY][net->remote];
+
+        if (frame < net->race.frame && mispredicted < 0 && !SameInput(*used, input))
+            mispredicted = frame;
+
+        *used = input;
+        net->remote_frames++;
+    }
+
+    // Frames still predicted now assume the last controls received
+    for (int frame = net->remote_frames; frame < net->race.frame && mispredicted < 0; ++frame)
+    {
+        if (!SameInput(net->inputs[frame % NETPLAY_HISTORY][net->remote], RemoteInput(net, frame)))
+            mispredicted = frame;
+    }
+
+    return mispredicted;
+}
+
+// Restores the race to the given frame and simulates it again up to the current one
+static void NetplayRollback(Netplay *net, int frame)
+{
+    int end = net->race.frame;
+
+    net->race = net->snapshots[frame % NETPLAY_HISTORY];
+
+    for (int f = frame; f < end; ++f)
+    {
+        PlayerInput *inputs = net->inputs[f % NETPLAY_HISTORY];
+
+        inputs[net->remote] = RemoteInput(net, f);
+        net->snapshots[f % NETPLAY_HISTORY] = net->race;
+        UpdateRace(net->level, &net->race, inputs, NULL);
+    }
+
+    net->rollbacks++;
+    net->resimulated_frames += end - frame;
+    if (end - frame > net->max_rollback)
+        net->max_rollback = end - frame;
+}
+
+// Starts a race against the game using remote_port. The game with the lowest port is player 0.
+bool InitNetplay(Netplay *net, Level *level, int port, int remote_port)
+{
+    memset(net, 0, sizeof(*net));
+
+    net->level = level;
+    net->local = (port < remote_port)? 0 : 1;
+    net->remote = 1 - net->local;
+    net->remote_port = remote_port;
+    net->rng = level->seed ^ port;
+
+    InitRace(level, &net->race, 2);
+
+    net->socket = UdpOpen(port);
+
+    return net->socket >= 0;
+}
+
+// Leaves the race, telling the rival
+void CloseNetplay(Netplay *net)
+{
+    if (net->socket < 0)
+        return;
+
+    // Lost packets are not simulated here, the rival would only notice it later
+    net->loss = 0;
+    net->latency = 0;
+    for (int i = 0; i < NETPLAY_BYE_PACKETS; ++i)
+        NetplaySend(net, NETPLAY_FLAG_BYE);
+
+    UdpClose(net->socket);
+    net->socket = -1;
+}
+
+void NetplaySetConditions(Netplay *net, double latency, float loss)
+{
+    net->latency = latency;
+    net->loss = loss;
+}
+
+// Reads the packets of the rival and corrects the race if they show a misprediction
+void NetplayPoll(Netplay *net)
+{
+    uint8_t data[NETPLAY_PACKET_SIZE];
+    int size;
+    int mispredicted = -1;
+
+    while ((size = UdpReceive(net->socket, data, sizeof(data))) >= 0)
+    {
+        int frame = NetplayReceive(net, data, size);
+
+        if (frame >= 0 && (mispredicted < 0 || frame < mispredicted))
+            mispredicted = frame;
+    }
+
+    if (mispredicted >= 0)
+        NetplayRollback(net, mispredicted);
+
+    if (net->last_receive > 0 && Now() - net->last_receive > NETPLAY_TIMEOUT)
+        net->remote_gone = true;
+
+    NetplaySendDelayed(net);
+}
+
+// Advances the race one frame with the local controls, unless it has to wait for the rival.
+// Returns whether it advanced, the SimEvent flags of the local pod are stored in events.
+bool NetplayUpdate(Netplay *net, PlayerInput input, int *events)
+{
+    NetplayPoll(net);
+
+    int frame = net->race.frame;
+
+    // Without a rival, its pod keeps its last controls, as they were predicted
+    if (net->remote_gone)
+    {
+        for (; net->remote_frames <= frame; net->remote_frames++)
+            net->inputs[net->remote_frames % NETPLAY_HISTORY][net->remote] = RemoteInput(net, net->remote_frames);
+        net->acked_frames = frame;
+    }
+
+    if (frame - net->remote_frames >= NETPLAY_MAX_ROLLBACK || frame - net->acked_frames >= NETPLAY_HISTORY/2)
+    {
+        NetplaySend(net, 0);
+        return false;
+    }
+
+    PlayerInput *inputs = net->inputs[frame % NETPLAY_HISTORY];
+    int race_events[RACE_MAX_PLAYERS];
+
+    inputs[net->local] = ReplayQuantizeInput(input);
+    inputs[net->remote] = RemoteInput(net, frame);
+    net->snapshots[frame % NETPLAY_HISTORY] = net->race;
+    UpdateRace(net->level, &net->race, inputs, race_events);
+
+    *events = race_events[net->local];
+
+    NetplaySend(net, 0);
+
+    return true;
+}
+
+// Frames of the race simulated with the real controls of both players, they won't change
+int NetplayConfirmedFrames(const Netplay *net)
+{
+    return (net->remote_frames < net->race.frame)? net->remote_frames : net->race.frame;
+}
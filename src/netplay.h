@@ -0,0 +1,103 @@
+/*******************************************************************************************
+*
+*   Nokia Pod Racer
+*   Netplay: head-to-head races between two games on the same machine, over UDP.
+*
+*   Uses rollback: every game simulates both pods right away, predicting that the rival keeps
+*   its last known controls. When the real controls arrive and differ, the race is restored
+*   to the snapshot of the first wrong frame and simulated again up to the current one. Each
+*   packet repeats every control the rival has not confirmed yet, so lost packets are covered
+*   by the next ones. A game waits for its rival if it gets NETPLAY_MAX_ROLLBACK frames ahead.
+*
+*   Network latency and packet loss can be simulated on the packets sent, to test it locally.
+*
+*   Copyright (c) 2023 Francisco Casas (@autopawn)
+*
+********************************************************************************************/
+
+#ifndef NETPLAY_H
+#define NETPLAY_H
+
+#include "simulation.h"
+
+#include <stdint.h>
+
+//----------------------------------------------------------------------------------
+// Netplay constants
+//----------------------------------------------------------------------------------
+#define NETPLAY_HISTORY 64              // Frames of controls and snapshots kept, a power of two
+#define NETPLAY_MAX_ROLLBACK 8
+#define NETPLAY_PACKET_SIZE (23 + NETPLAY_HISTORY)
+#define NETPLAY_DELAYED_PACKETS 64
+
+static const uint64_t NETPLAY_SEED = 0x2f1e5;
+static const double NETPLAY_TIMEOUT = 5.0;      // Seconds without packets to give the rival up
+
+//----------------------------------------------------------------------------------
+// Types and Structures Definition
+//----------------------------------------------------------------------------------
+
+// Packet held back to simulate latency
+typedef struct
+{
+    double send_time;
+    int size;
+    uint8_t data[NETPLAY_PACKET_SIZE];
+} NetplayPacket;
+
+typedef struct
+{
+    Level *level;
+    int local, remote;          // Index of each player in the race
+
+    int socket;
+    int remote_port;
+
+    RaceState race;             // Current race, it may use predicted controls
+
+    // Entry f % NETPLAY_HISTORY of each is for frame f: the race before simulating it and the
+    // controls it was simulated with. Remote controls of frames from remote_frames on are
+    // predictions.
+    RaceState snapshots[NETPLAY_HISTORY];
+    PlayerInput inputs[NETPLAY_HISTORY][RACE_MAX_PLAYERS];
+
+    int remote_frames;          // Frames of rival controls received
+    int acked_frames;           // Frames of local controls the rival has received
+    double last_receive;        // Time of the last packet from the rival, 0 if none yet
+    bool remote_gone;           // The rival left, its pod keeps its last controls
+
+    // Simulated network conditions
+    double latency;             // Seconds
+    float loss;                 // Fraction of packets dropped
+    uint64_t rng;
+    NetplayPacket delayed[NETPLAY_DELAYED_PACKETS];
+    int delayed_count;
+
+    // Stats
+    int rollbacks;
+    int resimulated_frames;
+    int max_rollback;
+} Netplay;
+
+#ifdef __cplusplus
+extern "C" {            // Prevents name mangling of functions
+#endif
+
+//----------------------------------------------------------------------------------
+// Netplay Functions Declaration
+//----------------------------------------------------------------------------------
+bool InitNetplay(Netplay *net, Level *level, int port, int remote_port);
+void CloseNetplay(Netplay *net);
+
+void NetplaySetConditions(Netplay *net, double latency, float loss);
+
+void NetplayPoll(Netplay *net);
+bool NetplayUpdate(Netplay *net, PlayerInput input, int *events);
+
+int NetplayConfirmedFrames(const Netplay *net);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // NETPLAY_H
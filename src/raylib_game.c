@@ -11,6 +11,8 @@
 ********************************************************************************************/
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "raylib.h"
 #include "screens.h"    // NOTE: Declares global (extern) variables and screens functions
@@ -30,18 +32,35 @@ LevelArea currentLevel = LEVEL_CITY;
 Font font = { 0 };
 Music music = { 0 };
 Sound fxCoin = { 0 };
-int lastGameTime = { 0 };
+float lastGameTime = { 0 };
 bool lastGameComplete = { 0 };
+int lastGameWinner = -1;
 bool isMusicOn = true;
+uint64_t nextLevelSeed = 0;
+bool benchmarkMode = false;
+int netplayPort = 0;
+int netplayRivalPort = 0;
+int localPlayers = 1;
+bool endlessMode = false;
+bool ghostRace = false;
+bool outlinePass = false;
+RenderTexture2D nokiaScreen = { 0 };
+GameplayStats gameplayStats = { 0 };
 
 //----------------------------------------------------------------------------------
 // Local Variables Definition (local to this module)
 //----------------------------------------------------------------------------------
-static RenderTexture2D nokiaScreen;
 static bool pixelSeparation = false;
 static const int screenWidth = 2*SCREEN_BORDER + SCREEN_SCALE_MULT*SCREEN_W;
 static const int screenHeight = 2*SCREEN_BORDER + SCREEN_SCALE_MULT*SCREEN_H;
 
+// Benchmark mode settings
+static const uint64_t BENCHMARK_SEED = 0xbe9c4;
+static const int BENCHMARK_FRAMES = 1800;
+
+// Frames per second drawn during races, the simulation keeps its own rate; 0 follows vsync
+static int renderFps = 60;
+
 // Required variables to manage screen transitions (fade-in, fade-out)
 static int transAlpha = 0;
 static int transLength = 8;
@@ -49,6 +68,8 @@ static bool onTransition = false;
 static bool transFadeOut = false;
 static int transFromScreen = -1;
 static GameScreen transToScreen = UNKNOWN;
+static const int TRANS_PIXEL_ORDER[4] = {2, 0, 1, 3};    // Order the pixels of each 2x2 block are lit in, by 2*(y%2) + x%2
+static Texture2D transDither[4];    // 2x2 dither patterns with 1 to 4 pixels lit, tiled on the screen
 int triggerLeftAxis = -1, triggerRightAxis = -1;
 bool triggerAxisDetected = false;
 
@@ -60,9 +81,15 @@ static void ChangeToScreen(int screen);     // Change to screen, no transition e
 static void TransitionToScreen(int screen); // Request transition to next screen
 static void UpdateTransition(void);         // Update transition effect
 static void DrawTransition(void);           // Draw transition effect (full-screen rectangle)
+static void LoadTransition(void);           // Load transition dither patterns
+static void UnloadTransition(void);         // Unload transition dither patterns
 
+static void UpdateFrame(void);              // Update one frame
+static void DrawFrame(void);                // Draw one frame
 static void UpdateDrawFrame(void);          // Update and draw one frame
 
+static int RunBenchmark(int frames);        // Time the gameplay frames of every level
+
 
 //----------------------------------------------------------------------------------
 // Save and load game
@@ -143,10 +170,51 @@ static inline bool hareDetectTriggerAxis()
 //----------------------------------------------------------------------------------
 // Main entry point
 //----------------------------------------------------------------------------------
-int main(void)
+int main(int argc, char **argv)
 {
+    int benchmarkFrames = 0;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (!strcmp(argv[i], "--benchmark"))
+        {
+            benchmarkFrames = BENCHMARK_FRAMES;
+            if (i + 1 < argc && atoi(argv[i + 1]) > 0)
+                benchmarkFrames = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--netplay") && i + 2 < argc)
+        {
+            netplayPort = atoi(argv[++i]);
+            netplayRivalPort = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--players") && i + 1 < argc)
+        {
+            localPlayers = atoi(argv[++i]);
+            if (localPlayers < 1) localPlayers = 1;
+            if (localPlayers > MAX_LOCAL_PLAYERS) localPlayers = MAX_LOCAL_PLAYERS;
+        }
+        else if (!strcmp(argv[i], "--endless"))
+        {
+            endlessMode = true;
+        }
+        else if (!strcmp(argv[i], "--ghost"))
+        {
+            ghostRace = true;
+        }
+        else if (!strcmp(argv[i], "--outline-pass"))
+        {
+            outlinePass = true;
+        }
+        else if (!strcmp(argv[i], "--fps") && i + 1 < argc)
+        {
+            renderFps = atoi(argv[++i]);
+            if (renderFps < 0) renderFps = 60;
+        }
+    }
+
     // Initialization
     //---------------------------------------------------------
+    if (renderFps == 0) SetConfigFlags(FLAG_VSYNC_HINT);
     InitWindow(screenWidth, screenHeight, "raylib game template");
 
     InitAudioDevice();      // Initialize audio device
@@ -160,6 +228,22 @@ int main(void)
 
     SetMusicVolume(music, isMusicOn);
 
+    if (benchmarkFrames > 0)
+    {
+        int result = RunBenchmark(benchmarkFrames);
+
+        UnloadFont(font);
+        UnloadMusicStream(music);
+        UnloadSound(fxCoin);
+        UnloadRenderTexture(nokiaScreen);
+        CloseAudioDevice();
+        CloseWindow();
+
+        return result;
+    }
+
+    LoadTransition();
+
     // Setup and init first screen
     currentScreen = LOGO;
     InitLogoScreen();
@@ -199,6 +283,7 @@ int main(void)
     UnloadMusicStream(music);
     UnloadSound(fxCoin);
     UnloadRenderTexture(nokiaScreen);
+    UnloadTransition();
 
     CloseAudioDevice();     // Close audio context
 
@@ -307,26 +392,47 @@ static void UpdateTransition(void)
     }
 }
 
-// Draw transition effect (full-screen rectangle)
-static void DrawTransition(void)
+// Load transition dither patterns, each one repeated over the whole screen when drawn
+static void LoadTransition(void)
 {
-    for (int x = 0; x < SCREEN_W; ++x)
+    for (int i = 0; i < 4; ++i)
     {
-        for (int y = 0; y < SCREEN_W; ++y)
-        {
-            int pixel_order = (int[]){2, 0, 1, 3}[2 * (y % 2) + (x % 2)];
+        Image image = GenImageColor(2, 2, BLANK);
 
-            if (transLength * pixel_order < 4 * transAlpha)
-                DrawPixel(x, y, SCREEN_COLOR_LIT);
+        for (int p = 0; p < 4; ++p)
+        {
+            if (TRANS_PIXEL_ORDER[p] <= i)
+                ImageDrawPixel(&image, p%2, p/2, SCREEN_COLOR_LIT);
         }
+
+        transDither[i] = LoadTextureFromImage(image);
+        SetTextureWrap(transDither[i], TEXTURE_WRAP_REPEAT);
+        UnloadImage(image);
     }
 }
 
-// Update and draw game frame
-static void UpdateDrawFrame(void)
+// Unload transition dither patterns
+static void UnloadTransition(void)
+{
+    for (int i = 0; i < 4; ++i)
+        UnloadTexture(transDither[i]);
+}
+
+// Draw transition effect (full-screen rectangle)
+static void DrawTransition(void)
+{
+    // Pixels lit on each 2x2 block, the ones with pixel order below it
+    int lit = 0;
+    while (lit < 4 && transLength * lit < 4 * transAlpha)
+        lit++;
+
+    if (lit > 0)
+        DrawTextureRec(transDither[lit - 1], (Rectangle){0, 0, SCREEN_W, SCREEN_H}, (Vector2){0, 0}, WHITE);
+}
+
+// Update game frame
+static void UpdateFrame(void)
 {
-    // Update
-    //----------------------------------------------------------------------------------
     if (!triggerAxisDetected)
         hareDetectTriggerAxis();
 
@@ -407,10 +513,11 @@ static void UpdateDrawFrame(void)
         }
     }
     else UpdateTransition();    // Update transition (fade-in, fade-out)
-    //----------------------------------------------------------------------------------
+}
 
-    // Draw
-    //----------------------------------------------------------------------------------
+// Draw game frame
+static void DrawFrame(void)
+{
     BeginTextureMode(nokiaScreen);
 
         ClearBackground(SCREEN_COLOR_BG);
@@ -458,5 +565,104 @@ static void UpdateDrawFrame(void)
                         line_color);
         }
     EndDrawing();
-    //----------------------------------------------------------------------------------
+}
+
+// Update and draw game frame
+static void UpdateDrawFrame(void)
+{
+#if !defined(PLATFORM_WEB)
+    // Menus advance one step per drawn frame, so only races are drawn at the chosen rate
+    SetTargetFPS((currentScreen == GAMEPLAY && !onTransition)? renderFps : 60);
+#endif
+    UpdateFrame();
+    DrawFrame();
+}
+
+static int CompareDoubles(const void *a, const void *b)
+{
+    double da = *(const double *) a;
+    double db = *(const double *) b;
+
+    return (da > db) - (da < db);
+}
+
+// Time in milliseconds of the given percentile, sorts the times
+static double Percentile(double *times, int count, int percentile)
+{
+    qsort(times, count, sizeof(*times), CompareDoubles);
+    return 1000*times[(count - 1)*percentile/100];
+}
+
+// Plays every level from a fixed seed, driven by the autopilot and with no frame limit, and reports
+// the update and draw time of the gameplay frames
+static int RunBenchmark(int frames)
+{
+    const char *levelNames[LEVEL_COUNT] = { "city", "forest", "lights", "ice" };
+
+    double *updateTimes = MemAlloc(sizeof(*updateTimes) * frames);
+    double *drawTimes = MemAlloc(sizeof(*drawTimes) * frames);
+
+    if (!updateTimes || !drawTimes)
+        return 1;
+
+    benchmarkMode = true;
+    isMusicOn = false;
+    SetMusicVolume(music, isMusicOn);
+
+    printf("BENCHMARK: %d frames per level, times in ms\n", frames);
+    printf("%-8s %8s %8s %8s   %8s %8s %8s   %10s %10s\n", "level",
+            "upd p50", "upd p95", "upd p99", "draw p50", "draw p95", "draw p99", "draw calls", "obstacles");
+
+    for (int area = 0; area < LEVEL_COUNT; ++area)
+    {
+        long drawCalls = 0;
+        long drawnObstacles = 0;
+
+        currentLevel = area;
+        currentScreen = GAMEPLAY;
+        nextLevelSeed = BENCHMARK_SEED + area;
+        InitGameplayScreen();
+
+        for (int i = 0; i < frames; ++i)
+        {
+            double start = GetTime();
+            UpdateGameplayScreen();
+            double updated = GetTime();
+            DrawFrame();
+            double drawn = GetTime();
+
+            updateTimes[i] = updated - start;
+            drawTimes[i] = drawn - updated;
+            drawCalls += gameplayStats.drawCalls;
+            drawnObstacles += gameplayStats.drawnObstacles;
+
+            // Keep racing on the same level when the race is over
+            if (FinishGameplayScreen())
+            {
+                UnloadGameplayScreen();
+                nextLevelSeed = BENCHMARK_SEED + area;
+                InitGameplayScreen();
+            }
+        }
+
+        UnloadGameplayScreen();
+
+        double updateP50 = Percentile(updateTimes, frames, 50);
+        double updateP95 = Percentile(updateTimes, frames, 95);
+        double updateP99 = Percentile(updateTimes, frames, 99);
+        double drawP50 = Percentile(drawTimes, frames, 50);
+        double drawP95 = Percentile(drawTimes, frames, 95);
+        double drawP99 = Percentile(drawTimes, frames, 99);
+
+        printf("%-8s %8.3f %8.3f %8.3f   %8.3f %8.3f %8.3f   %10.1f %10.1f\n", levelNames[area],
+                updateP50, updateP95, updateP99, drawP50, drawP95, drawP99,
+                (double) drawCalls/frames, (double) drawnObstacles/frames);
+    }
+
+    benchmarkMode = false;
+
+    MemFree(updateTimes);
+    MemFree(drawTimes);
+
+    return 0;
 }
@@ -0,0 +1,344 @@
+/*******************************************************************************************
+*
+*   Nokia Pod Racer
+*   Replays: the level seed and the controls of every frame of a race.
+*
+*   File layout, little endian: "NPR1", area (u8), seed (u64), frames (u32), time_playing (u32),
+*   data size (u32), checksums count (u32), the data bytes and then the checksums (u32 each).
+*   The top bit of the area byte is set for races with fixed-point physics, the next one for
+*   races on endless levels.
+*
+*   Copyright (c) 2023 Francisco Casas (@autopawn)
+*
+********************************************************************************************/
+
+#include "raylib.h"
+#include "raymath.h"
+#include "replay.h"
+
+#include <math.h>
+#include <string.h>
+
+#define REPLAY_HEADER_SIZE 29
+#define REPLAY_FIXED_FLAG 0x80
+#define REPLAY_ENDLESS_FLAG 0x40
+#define REPLAY_AREA_FLAGS (REPLAY_FIXED_FLAG | REPLAY_ENDLESS_FLAG)
+
+//----------------------------------------------------------------------------------
+// Module Functions Definition
+//----------------------------------------------------------------------------------
+
+static void ReplayPushByte(Replay *replay, uint8_t byte)
+{
+    if (replay->data_size == replay->data_capacity)
+    {
+        replay->data_capacity = (replay->data_capacity == 0)? 1024 : 2*replay->data_capacity;
+        replay->data = MemRealloc(replay->data, replay->data_capacity);
+    }
+    replay->data[replay->data_size++] = byte;
+}
+
+static void ReplayPushVarint(Replay *replay, unsigned int value)
+{
+    while (value >= 0x80)
+    {
+        ReplayPushByte(replay, (value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    ReplayPushByte(replay, value);
+}
+
+static unsigned int ZigZag(int value)
+{
+    return (value < 0)? 2*(unsigned int) (-value) - 1 : 2*(unsigned int) value;
+}
+
+static int UnZigZag(unsigned int value)
+{
+    return (value & 1)? -(int) ((value + 1)/2) : (int) (value/2);
+}
+
+static float TurboValue(int steps)
+{
+    return (float) steps/REPLAY_TURBO_STEPS;
+}
+
+static int TurboSteps(float turbo)
+{
+    return (int) roundf(Clamp(turbo, 0, 2)*REPLAY_TURBO_STEPS);
+}
+
+static void PutU32(uint8_t *bytes, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i)
+        bytes[i] = value >> (8*i);
+}
+
+static uint32_t GetU32(const uint8_t *bytes)
+{
+    uint32_t value = 0;
+
+    for (int i = 0; i < 4; ++i)
+        value |= (uint32_t) bytes[i] << (8*i);
+    return value;
+}
+
+// FNV-1a
+static uint32_t HashBytes(uint32_t hash, const void *data, int size)
+{
+    const uint8_t *bytes = data;
+
+    for (int i = 0; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Starts an empty replay. The replay must be zeroed or hold a previous one, whose buffers are
+// reused.
+void InitReplay(Replay *replay, LevelArea area, uint64_t seed)
+{
+    uint8_t *data = replay->data;
+    int data_capacity = replay->data_capacity;
+    uint32_t *checksums = replay->checksums;
+    int checksums_capacity = replay->checksums_capacity;
+
+    *replay = (Replay){0};
+    replay->area = area;
+    replay->seed = seed;
+    replay->data = data;
+    replay->data_capacity = data_capacity;
+    replay->checksums = checksums;
+    replay->checksums_capacity = checksums_capacity;
+}
+
+void UnloadReplay(Replay *replay)
+{
+    MemFree(replay->data);
+    MemFree(replay->checksums);
+    *replay = (Replay){0};
+}
+
+// Controls as they will be read back from the replay, the race must be simulated with these
+PlayerInput ReplayQuantizeInput(PlayerInput input)
+{
+    return (PlayerInput){TurboValue(TurboSteps(input.turbo_l)), TurboValue(TurboSteps(input.turbo_r))};
+}
+
+// Records the controls of one frame and the pod after simulating it
+void ReplayRecord(Replay *replay, PlayerInput input, const Player *player)
+{
+    int l = TurboSteps(input.turbo_l);
+    int r = TurboSteps(input.turbo_r);
+
+    if (replay->run_frames > 0 && (l != replay->run_l || r != replay->run_r))
+        ReplayFlush(replay);
+
+    replay->run_l = l;
+    replay->run_r = r;
+    replay->run_frames++;
+
+    replay->frames++;
+    replay->time_playing = player->time_playing;
+
+    if (replay->frames % REPLAY_CHECKSUM_FRAMES == 0)
+    {
+        if (replay->checksums_count == replay->checksums_capacity)
+        {
+            replay->checksums_capacity = (replay->checksums_capacity == 0)? 256 : 2*replay->checksums_capacity;
+            replay->checksums = MemRealloc(replay->checksums, replay->checksums_capacity*sizeof(*replay->checksums));
+        }
+        replay->checksums[replay->checksums_count++] = PlayerChecksum(player);
+    }
+}
+
+// Writes the run being recorded, must be called before saving or reading the replay
+void ReplayFlush(Replay *replay)
+{
+    if (replay->run_frames == 0)
+        return;
+
+    ReplayPushVarint(replay, ZigZag(replay->run_l - replay->last_l));
+    ReplayPushVarint(replay, ZigZag(replay->run_r - replay->last_r));
+    ReplayPushVarint(replay, replay->run_frames);
+
+    replay->last_l = replay->run_l;
+    replay->last_r = replay->run_r;
+    replay->run_frames = 0;
+}
+
+bool SaveReplay(const Replay *replay, const char *fileName)
+{
+    int size = REPLAY_HEADER_SIZE + replay->data_size + 4*replay->checksums_count;
+    uint8_t *bytes = MemAlloc(size);
+
+    memcpy(bytes, "NPR1", 4);
+    bytes[4] = replay->area | (replay->physics_mode == PHYSICS_FIXED)*REPLAY_FIXED_FLAG | replay->endless*REPLAY_ENDLESS_FLAG;
+    PutU32(bytes + 5, replay->seed);
+    PutU32(bytes + 9, replay->seed >> 32);
+    PutU32(bytes + 13, replay->frames);
+    PutU32(bytes + 17, replay->time_playing);
+    PutU32(bytes + 21, replay->data_size);
+    PutU32(bytes + 25, replay->checksums_count);
+
+    if (replay->data_size > 0)
+        memcpy(bytes + REPLAY_HEADER_SIZE, replay->data, replay->data_size);
+    for (int i = 0; i < replay->checksums_count; ++i)
+        PutU32(bytes + REPLAY_HEADER_SIZE + replay->data_size + 4*i, replay->checksums[i]);
+
+    bool success = SaveFileData(fileName, bytes, size);
+    MemFree(bytes);
+
+    return success;
+}
+
+bool LoadReplay(Replay *replay, const char *fileName)
+{
+    unsigned int size = 0;
+    uint8_t *bytes = LoadFileData(fileName, &size);
+
+    if (!bytes)
+        return false;
+
+    bool valid = size >= REPLAY_HEADER_SIZE && !memcmp(bytes, "NPR1", 4) && (bytes[4] & ~REPLAY_AREA_FLAGS) < LEVEL_COUNT;
+
+    if (valid)
+    {
+        uint32_t data_size = GetU32(bytes + 21);
+        uint32_t checksums_count = GetU32(bytes + 25);
+
+        valid = data_size <= size && checksums_count <= size/4 &&
+                REPLAY_HEADER_SIZE + data_size + 4*(uint64_t) checksums_count == size;
+
+        if (valid)
+        {
+            InitReplay(replay, bytes[4] & ~REPLAY_AREA_FLAGS, GetU32(bytes + 5) | (uint64_t) GetU32(bytes + 9) << 32);
+            replay->physics_mode = (bytes[4] & REPLAY_FIXED_FLAG)? PHYSICS_FIXED : PHYSICS_FLOAT;
+            replay->endless = (bytes[4] & REPLAY_ENDLESS_FLAG) != 0;
+            replay->frames = GetU32(bytes + 13);
+            replay->time_playing = GetU32(bytes + 17);
+
+            for (uint32_t i = 0; i < data_size; ++i)
+                ReplayPushByte(replay, bytes[REPLAY_HEADER_SIZE + i]);
+
+            replay->checksums = MemRealloc(replay->checksums, (checksums_count + 1)*sizeof(*replay->checksums));
+            replay->checksums_capacity = checksums_count + 1;
+            for (uint32_t i = 0; i < checksums_count; ++i)
+                replay->checksums[i] = GetU32(bytes + REPLAY_HEADER_SIZE + data_size + 4*i);
+            replay->checksums_count = checksums_count;
+        }
+    }
+
+    UnloadFileData(bytes);
+
+    return valid;
+}
+
+ReplayReader ReplayRead(const Replay *replay)
+{
+    return (ReplayReader){replay, 0, 0, 0, 0};
+}
+
+static unsigned int ReplayReadVarint(ReplayReader *reader)
+{
+    unsigned int value = 0;
+
+    for (int shift = 0; reader->pos < reader->replay->data_size && shift < 32; shift += 7)
+    {
+        uint8_t byte = reader->replay->data[reader->pos++];
+
+        value |= (unsigned int) (byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            break;
+    }
+    return value;
+}
+
+// Controls of the next frame, no controls once the replay is over
+PlayerInput ReplayNextInput(ReplayReader *reader)
+{
+    if (reader->run_frames == 0)
+    {
+        if (reader->pos >= reader->replay->data_size)
+            return (PlayerInput){0};
+
+        reader->l += UnZigZag(ReplayReadVarint(reader));
+        reader->r += UnZigZag(ReplayReadVarint(reader));
+        reader->run_frames = ReplayReadVarint(reader);
+    }
+
+    reader->run_frames--;
+
+    return (PlayerInput){TurboValue(reader->l), TurboValue(reader->r)};
+}
+
+// Hash of the pod state
+uint32_t PlayerChecksum(const Player *player)
+{
+    uint32_t hash = 2166136261u;
+
+    hash = HashBytes(hash, &player->ang, sizeof(player->ang));
+    hash = HashBytes(hash, &player->ang_spd, sizeof(player->ang_spd));
+    hash = HashBytes(hash, &player->pos, sizeof(player->pos));
+    hash = HashBytes(hash, &player->pos_spd, sizeof(player->pos_spd));
+    hash = HashBytes(hash, &player->time_death, sizeof(player->time_death));
+    hash = HashBytes(hash, &player->n_carrots, sizeof(player->n_carrots));
+    hash = HashBytes(hash, &player->carrot_pos, sizeof(player->carrot_pos));
+    hash = HashBytes(hash, &player->time_playing, sizeof(player->time_playing));
+    hash = HashBytes(hash, &player->time_finish, sizeof(player->time_finish));
+
+    return hash;
+}
+
+// Simulates the race again, as fast as possible, and checks it against the recorded one
+ReplayCheck VerifyReplay(const Replay *replay)
+{
+    ReplayCheck check = {true, -1, 0, 0, false};
+
+    Level *level = replay->endless? LevelGenerateEndless(replay->area, replay->seed) : LevelGenerate(replay->area, replay->seed);
+    level->physics_mode = replay->physics_mode;
+
+    // A race of one pod, so the player is only gathered for the checksums
+    RaceState race;
+    InitRace(level, &race, 1);
+
+    ReplayReader reader = ReplayRead(replay);
+
+    for (int frame = 0; frame < replay->frames; ++frame)
+    {
+        PlayerInput input = ReplayNextInput(&reader);
+
+        UpdateRace(level, &race, &input, NULL);
+
+        if ((frame + 1) % REPLAY_CHECKSUM_FRAMES == 0)
+        {
+            int i = (frame + 1)/REPLAY_CHECKSUM_FRAMES - 1;
+            Player player = RacePlayer(&race, 0);
+
+            if (i < replay->checksums_count && replay->checksums[i] != PlayerChecksum(&player))
+            {
+                check.ok = false;
+                check.failed_frame = frame;
+                break;
+            }
+        }
+    }
+
+    Player player = RacePlayer(&race, 0);
+
+    check.time_playing = player.time_playing;
+    check.time_finish = player.time_finish;
+    check.complete = (player.n_carrots == TARGET_N_CARROTS);
+
+    if (check.ok && check.time_playing != replay->time_playing)
+    {
+        check.ok = false;
+        check.failed_frame = replay->frames - 1;
+    }
+
+    UnloadLevel(level);
+
+    return check;
+}
@@ -0,0 +1,99 @@
+/*******************************************************************************************
+*
+*   Nokia Pod Racer
+*   Replays: the level seed and the controls of every frame of a race.
+*
+*   Since the simulation is deterministic, that is enough to simulate the race again. Controls
+*   are quantized to REPLAY_TURBO_STEPS per unit before being simulated, so the recorded race
+*   and its replay see exactly the same values. They are stored as runs of repeated controls,
+*   which are long with keyboard controls, and a checksum of the pod state is stored every
+*   REPLAY_CHECKSUM_FRAMES to find where a replay stops matching the race.
+*
+*   Copyright (c) 2023 Francisco Casas (@autopawn)
+*
+********************************************************************************************/
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include "simulation.h"
+
+#include <stdint.h>
+
+//----------------------------------------------------------------------------------
+// Replay constants
+//----------------------------------------------------------------------------------
+static const int REPLAY_TURBO_STEPS = 100;
+static const int REPLAY_CHECKSUM_FRAMES = 60;
+
+//----------------------------------------------------------------------------------
+// Types and Structures Definition
+//----------------------------------------------------------------------------------
+typedef struct
+{
+    LevelArea area;
+    uint64_t seed;
+    PhysicsMode physics_mode;   // Physics the race was simulated with
+    bool endless;               // The race was on an endless level
+
+    int frames;                 // Frames recorded
+    int time_playing;           // Race clock of the pod after the last frame
+
+    // Runs of controls: zigzag varints with the change of turbo_l and turbo_r, in steps, and
+    // the number of frames they were held
+    uint8_t *data;
+    int data_size, data_capacity;
+
+    uint32_t *checksums;        // checksums[i] is the pod state after frame (i + 1)*REPLAY_CHECKSUM_FRAMES - 1
+    int checksums_count, checksums_capacity;
+
+    // Run being recorded
+    int run_l, run_r, run_frames;
+    int last_l, last_r;
+} Replay;
+
+// Reads the controls of a replay back, frame by frame
+typedef struct
+{
+    const Replay *replay;
+    int pos;
+    int l, r, run_frames;
+} ReplayReader;
+
+typedef struct
+{
+    bool ok;                    // Every checksum matches and the race clock is the recorded one
+    int failed_frame;           // First frame that didn't match, -1 if ok
+    int time_playing;           // Race clock reached by the replay
+    float time_finish;          // Race time, in frames, if complete
+    bool complete;              // All the carrots were grabbed
+} ReplayCheck;
+
+#ifdef __cplusplus
+extern "C" {            // Prevents name mangling of functions
+#endif
+
+//----------------------------------------------------------------------------------
+// Replay Functions Declaration
+//----------------------------------------------------------------------------------
+void InitReplay(Replay *replay, LevelArea area, uint64_t seed);
+void UnloadReplay(Replay *replay);
+
+PlayerInput ReplayQuantizeInput(PlayerInput input);
+void ReplayRecord(Replay *replay, PlayerInput input, const Player *player);
+void ReplayFlush(Replay *replay);
+
+bool SaveReplay(const Replay *replay, const char *fileName);
+bool LoadReplay(Replay *replay, const char *fileName);
+
+ReplayReader ReplayRead(const Replay *replay);
+PlayerInput ReplayNextInput(ReplayReader *reader);
+
+uint32_t PlayerChecksum(const Player *player);
+ReplayCheck VerifyReplay(const Replay *replay);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // REPLAY_H
@@ -0,0 +1,169 @@
+/*******************************************************************************************
+*
+*   Nokia Pod Racer
+*   Replay checker: simulates replays again, headless and on all the cores, and checks that
+*   they reproduce the recorded races.
+*
+*   With --savegame, the race time of each replay is also compared with the record saved for
+*   its level, to confirm that the record can be reproduced.
+*
+*   Usage: replaycheck [--threads N] [--savegame savegame.dat] replay.rpl...
+*
+*   Copyright (c) 2023 Francisco Casas (@autopawn)
+*
+********************************************************************************************/
+
+#include "raylib.h"
+#include "screens.h"
+#include "replay.h"
+#include "jobs.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+//----------------------------------------------------------------------------------
+// Types and Structures Definition
+//----------------------------------------------------------------------------------
+typedef struct
+{
+    Replay *replays;
+    ReplayCheck *checks;
+} ReplayJobs;
+
+//----------------------------------------------------------------------------------
+// Module Functions Definition
+//----------------------------------------------------------------------------------
+static double Now(void)
+{
+    struct timespec ts;
+
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static void VerifyReplayJob(void *data, int job, int worker)
+{
+    (void) worker;
+
+    ReplayJobs *jobs = data;
+    jobs->checks[job] = VerifyReplay(&jobs->replays[job]);
+}
+
+//----------------------------------------------------------------------------------
+// Main entry point
+//----------------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+    const char *areaNames[LEVEL_COUNT] = { "city", "forest", "lights", "ice" };
+
+    const char *savegame = NULL;
+    int threads = GetCoreCount();
+    int first = 1;
+
+    for (; first < argc && !strncmp(argv[first], "--", 2); ++first)
+    {
+        if (!strcmp(argv[first], "--threads") && first + 1 < argc)
+            threads = atoi(argv[++first]);
+        else if (!strcmp(argv[first], "--savegame") && first + 1 < argc)
+            savegame = argv[++first];
+        else
+            break;
+    }
+
+    int count = argc - first;
+
+    if (count <= 0 || !strncmp(argv[first], "--", 2))
+    {
+        fprintf(stderr, "usage: %s [--threads N] [--savegame savegame.dat] replay.rpl...\n", argv[0]);
+        return 2;
+    }
+
+    SetTraceLogLevel(LOG_WARNING);
+
+    GamePersistentData records = {0};
+
+    if (savegame)
+    {
+        unsigned int size = 0;
+        unsigned char *data = LoadFileData(savegame, &size);
+
+        if (!data || size < sizeof(records))
+        {
+            fprintf(stderr, "Could not read %s\n", savegame);
+            return 2;
+        }
+        memcpy(&records, data, sizeof(records));
+        UnloadFileData(data);
+    }
+
+    ReplayJobs jobs;
+    jobs.replays = calloc(count, sizeof(*jobs.replays));
+    jobs.checks = calloc(count, sizeof(*jobs.checks));
+
+    for (int i = 0; i < count; ++i)
+    {
+        if (!LoadReplay(&jobs.replays[i], argv[first + i]))
+        {
+            fprintf(stderr, "Could not read replay %s\n", argv[first + i]);
+            return 2;
+        }
+    }
+
+    double start = Now();
+    RunJobs(VerifyReplayJob, &jobs, count, threads);
+    double elapsed = Now() - start;
+
+    int failures = 0;
+    long long frames = 0;
+
+    for (int i = 0; i < count; ++i)
+    {
+        const Replay *replay = &jobs.replays[i];
+        ReplayCheck check = jobs.checks[i];
+        int seconds = (int) (check.time_finish/SIM_FPS);
+
+        frames += replay->frames;
+
+        printf("%s: %s%s%s, %d frames, %d bytes, ", argv[first + i], areaNames[replay->area],
+                replay->endless? " endless" : "", (replay->physics_mode == PHYSICS_FIXED)? " (fixed-point)" : "", replay->frames,
+                replay->data_size + 4*replay->checksums_count);
+
+        if (check.ok)
+        {
+            if (check.complete)
+                printf("OK, time %02d:%05.2f", seconds/60, fmodf(check.time_finish/SIM_FPS, 60));
+            else
+                printf("OK, not finished");
+        }
+        else
+        {
+            printf("MISMATCH at frame %d", check.failed_frame);
+            failures++;
+        }
+
+        if (savegame && check.ok && check.complete)
+        {
+            if (seconds == records.time[replay->area])
+                printf(", reproduces the saved record");
+            else
+            {
+                printf(", saved record is %02d:%02d", records.time[replay->area]/60, records.time[replay->area]%60);
+                failures++;
+            }
+        }
+        printf("\n");
+    }
+
+    printf("%d replays in %.3f s on %d threads: %.0f frames/s, %.0fx real time\n", count, elapsed, threads,
+            frames/elapsed, frames/elapsed/60);
+
+    for (int i = 0; i < count; ++i)
+        UnloadReplay(&jobs.replays[i]);
+    free(jobs.replays);
+    free(jobs.checks);
+
+    return failures ? 1 : 0;
+}
@@ -29,6 +29,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <math.h>
 
 //----------------------------------------------------------------------------------
 // Module Variables Definition (local)
@@ -51,14 +52,25 @@ void InitEndingScreen(void)
 
     niceSound = LoadSound("resources/nice.mp3");
 
-    /* Update persistent game data */
-    if (lastGameComplete && (persistentData.time[currentLevel] == 0 || lastGameTime < persistentData.time[currentLevel]))
+    /* Update persistent game data, records are kept in whole seconds. Split screen races
+       and races on endless levels don't set records. */
+    int seconds = (int) lastGameTime;
+
+    if (lastGameWinner < 0 && lastGameComplete && !endlessMode && (persistentData.time[currentLevel] == 0 || seconds < persistentData.time[currentLevel]))
     {
-        persistentData.time[currentLevel] = lastGameTime;
+        persistentData.time[currentLevel] = seconds;
         newRecord = true;
         PlaySound(niceSound);
 
         SaveGame();
+
+        // Later races on this level are raced against this one
+        SaveGameplayGhost(TextFormat("ghost%d.npg", currentLevel));
+
+        // Keep the record run, so it can be checked to be reproducible
+        #ifndef PLATFORM_WEB
+            SaveGameplayReplay(TextFormat("record%d.rpl", currentLevel));
+        #endif
     }
 }
 
@@ -90,13 +102,23 @@ void DrawEndingScreen(void)
         w = MeasureText(buffer, font_size);
         DrawText(buffer, SCREEN_W/2 - w/2, 20, font_size, SCREEN_COLOR_LIT);
     }
+    else if (lastGameWinner >= 0)
+    {
+        sprintf(buffer, "Player %d wins!", lastGameWinner + 1);
+        w = MeasureText(buffer, font_size);
+        DrawText(buffer, SCREEN_W/2 - w/2, 8, font_size, SCREEN_COLOR_LIT);
+
+        sprintf(buffer, "Time: %02d:%05.2f", (int) lastGameTime/60, fmodf(lastGameTime, 60));
+        w = MeasureText(buffer, font_size);
+        DrawText(buffer, SCREEN_W/2 - w/2, 20, font_size, SCREEN_COLOR_LIT);
+    }
     else
     {
         sprintf(buffer, "Complete!");
         w = MeasureText(buffer, font_size);
         DrawText(buffer, SCREEN_W/2 - w/2, 8, font_size, SCREEN_COLOR_LIT);
 
-        sprintf(buffer, "Time: %02d:%02d", lastGameTime/60, lastGameTime%60);
+        sprintf(buffer, "Time: %02d:%05.2f", (int) lastGameTime/60, fmodf(lastGameTime, 60));
         w = MeasureText(buffer, font_size);
         DrawText(buffer, SCREEN_W/2 - w/2, 20, font_size, SCREEN_COLOR_LIT);
 
@@ -25,30 +25,224 @@
 
 #include "raylib.h"
 #include "raymath.h"
+#include "rlgl.h"
 #include "screens.h"
+#include "simulation.h"
+#include "autopilot.h"
+#include "replay.h"
+#include "ghost.h"
+#include "netplay.h"
 
 #include <stdlib.h>
-#include <assert.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
 
-static const int MAP_SIZE = 500;
-static const int MAP_SIZE_FOREST = 300;
-static const int N_MAP_OBSTACLES = 4000;
-static const int PLAYER_DEATH_ANIMATION_TIME = 200;
-static const int PLAYER_CARROT_GRAB_ANIMATION_TIME = 60;
 static const int UI_FONT_SIZE = 8;
-static const int CARROT_SPAN_DIST = 200;
-static const int TARGET_N_CARROTS = 5;
-
-const float PLAYER_RAD = 0.26;
-const float CARROT_RAD = 0.24;
+static const int MAX_STEPS_PER_FRAME = 5;   // Above this, a slow frame slows the race down
 
 const float CARROT_IN_VIEW_DISTANCE = 30;
 
+// Races are drawn up to RENDER_DISTANCE, with detail up to LOD_DISTANCE, then both distances
+// follow the time the views take to draw, within the limits
 const float LOD_DISTANCE = 15;
 const float RENDER_DISTANCE = 45;
+static const float RENDER_DISTANCE_MIN = 25;
+static const float RENDER_DISTANCE_MAX = 60;
+static const float DRAW_TIME_TARGET = 0.004f;   // Seconds drawing the views of a frame
+static const float DRAW_TIME_HIGH = 1.25f;      // Above the target by this, the distances shrink
+static const float DRAW_TIME_LOW = 0.6f;        // Below the target by this, the distances grow
+static const int DISTANCE_ADAPT_FRAMES = 30;    // Frames after a change before the next one
+
+static const int CHUNK_STREAM_BUDGET = 1;   // Chunks of an endless level generated per frame and view
+#define VIEW_CHUNKS 25                      // Chunks within RENDER_DISTANCE_MAX of a camera, at most
+static const int CULL_BLOCK_CELLS = 8;      // Side of the blocks of grid cells culled together
+static const float OBSTACLE_TOP = 2.2;      // Height of the tallest obstacle
+
+// Radius of a sphere around (x, 1, z) with all the drawn obstacle, by ObstacleType
+static const float OBSTACLE_DRAW_RAD[] = {1.3, 1.4, 4.2, 1.8};
+static const float HAZARD_DRAW_RAD = 0.8;
+
+// Occlusion of the obstacles of the city and forest by the ones in front of them, by ObstacleType.
+// Obstacles are seen from above as squares of half side OBSTACLE_VIEW_HALF, up to OBSTACLE_VIEW_TOP.
+// A square of half side OCCLUDER_HALF is solid from the ground up to OCCLUDER_TOP, for trees it is
+// the trunk with the crown over it.
+static const float OBSTACLE_VIEW_HALF[] = {0.52, 0.52, 4.0, 1.02};
+static const float OBSTACLE_VIEW_TOP[] = {2.02, 2.2, 1.62, 1.72};
+static const float OCCLUDER_HALF[] = {0.5, 0.2, 0, 0};
+static const float OCCLUDER_TOP[] = {2.0, 2.0, 0, 0};
+static const int OCCLUSION_SLICES_PER_COLUMN = 2;
+#define OCCLUSION_MAX_SLICES (2*SCREEN_W)
+#define OCCLUSION_PENDING 16                // Occluders kept until the obstacles are behind them
+
+// Snow of the ice level: flakes falling over a square tile of the level, repeated around the camera
+#define SNOW_FLAKES 768
+static const float SNOW_TILE = 16;
+static const float SNOW_FALL_MIN = 4;       // Heights the flakes fall from
+static const float SNOW_FALL_MAX = 6;
+static const float SNOW_SPEED = 0.04;       // Fall per simulation step
+static const float SNOW_FLAKE_SIZE = 0.1;
+
+// Shaders are written for GLSL 100, writing FRAG_COLOR. The header of the platform adapts them to its
+// GLSL version.
+#if defined(PLATFORM_DESKTOP)
+static const char *SHADER_VS_HEADER =
+    "#version 330\n"
+    "#define attribute in\n"
+    "#define varying out\n";
+static const char *SHADER_FS_HEADER =
+    "#version 330\n"
+    "#define varying in\n"
+    "#define texture2D texture\n"
+    "out vec4 finalColor;\n"
+    "#define FRAG_COLOR finalColor\n";
+#else
+static const char *SHADER_VS_HEADER =
+    "#version 100\n";
+static const char *SHADER_FS_HEADER =
+    "#version 100\n"
+    "#extension GL_OES_standard_derivatives : enable\n"
+    "#ifdef GL_FRAGMENT_PRECISION_HIGH\n"
+    "precision highp float;\n"
+    "#else\n"
+    "precision mediump float;\n"
+    "#endif\n"
+    "#define FRAG_COLOR gl_FragColor\n";
+#endif
+
+// Instanced unit meshes, with the sides of the faces of bordered parts drawn lit
+#if defined(PLATFORM_DESKTOP) || defined(PLATFORM_WEB)
+static const char *OBSTACLE_VS =
+    "attribute vec3 vertexPosition;\n"
+    "attribute vec2 vertexTexCoord;\n"
+    "attribute mat4 instanceTransform;\n"
+    "uniform mat4 mvp;\n"
+    "varying vec2 fragTexCoord;\n"
+    "void main()\n"
+    "{\n"
+    "    fragTexCoord = vertexTexCoord;\n"
+    "    gl_Position = mvp*instanceTransform*vec4(vertexPosition, 1.0);\n"
+    "}\n";
+static const char *OBSTACLE_FS =
+    "varying vec2 fragTexCoord;\n"
+    "uniform vec4 colDiffuse;\n"
+    "uniform vec4 edgeColor;\n"
+    "uniform float edgeWidth;\n"
+    "void main()\n"
+    "{\n"
+    "    vec2 edge = fwidth(fragTexCoord)*edgeWidth;\n"
+    "    bool border = any(lessThan(fragTexCoord, edge)) || any(greaterThan(fragTexCoord, 1.0 - edge));\n"
+    "    FRAG_COLOR = border? edgeColor : colDiffuse;\n"
+    "}\n";
+#endif
+
+// Outline pass: the 3D scene of a view is drawn on a target of its own with flat faces, coding on
+// each pixel its SCENE_* flags with the face (red), an identifier of the object (green) and its
+// distance (blue and alpha). Copying it to the screen, the edges of the bordered objects are found
+// from the codes of the neighbor pixels, and drawn with the color opposite to their fill.
+static const int SCENE_DRAWN = 1;
+static const int SCENE_LIT = 2;
+static const int SCENE_BORDERED = 4;
+
+// Immediate mode geometry, with the flags and the object identifier on the vertex colors
+static const char *SCENE_VS =
+    "attribute vec3 vertexPosition;\n"
+    "attribute vec4 vertexColor;\n"
+    "uniform mat4 mvp;\n"
+    "varying vec3 fragPosition;\n"
+    "varying vec4 fragColor;\n"
+    "varying float fragDistance;\n"
+    "void main()\n"
+    "{\n"
+    "    fragPosition = vertexPosition;\n"
+    "    fragColor = vertexColor;\n"
+    "    gl_Position = mvp*vec4(vertexPosition, 1.0);\n"
+    "    fragDistance = gl_Position.w;\n"
+    "}\n";
+// Instanced obstacle parts, identified by where they are
+static const char *SCENE_INSTANCED_VS =
+    "attribute vec3 vertexPosition;\n"
+    "attribute mat4 instanceTransform;\n"
+    "uniform mat4 mvp;\n"
+    "uniform float flags;\n"
+    "varying vec3 fragPosition;\n"
+    "varying vec4 fragColor;\n"
+    "varying float fragDistance;\n"
+    "void main()\n"
+    "{\n"
+    "    vec4 position = instanceTransform*vec4(vertexPosition, 1.0);\n"
+    "    vec3 origin = instanceTransform[3].xyz;\n"
+    "    fragPosition = position.xyz;\n"
+    "    fragColor = vec4(flags, mod(floor(7.0*origin.x + 13.0*origin.z), 256.0), 0.0, 255.0)/255.0;\n"
+    "    gl_Position = mvp*position;\n"
+    "    fragDistance = gl_Position.w;\n"
+    "}\n";
+// Faces are told apart by the axis and direction of their normal, distances up to 256 are kept
+static const char *SCENE_FS =
+    "varying vec3 fragPosition;\n"
+    "varying vec4 fragColor;\n"
+    "varying float fragDistance;\n"
+    "void main()\n"
+    "{\n"
+    "    vec3 normal = cross(dFdx(fragPosition), dFdy(fragPosition));\n"
+    "    vec3 axis = abs(normal);\n"
+    "    float face = (axis.x > axis.y && axis.x > axis.z)? 1.0 + step(0.0, normal.x) :\n"
+    "            (axis.y > axis.z)? 3.0 + step(0.0, normal.y) : 5.0 + step(0.0, normal.z);\n"
+    "    float flags = floor(fragColor.r*255.0 + 0.5);\n"
+    "    float depth = floor(clamp(fragDistance/256.0, 0.0, 1.0)*65535.0);\n"
+    "    FRAG_COLOR = vec4(flags + 8.0*face, floor(fragColor.g*255.0 + 0.5), floor(depth/256.0), mod(depth, 256.0))/255.0;\n"
+    "}\n";
+// Copy of the scene to the screen. Like the lines of the bounding boxes did, the edges of bordered
+// objects are drawn around them, on the pixels next to them that are behind. Edges between faces
+// of an object, or objects as near, are drawn on the pixel after them.
+static const char *OUTLINE_FS =
+    "varying vec2 fragTexCoord;\n"
+    "uniform sampler2D texture0;\n"
+    "uniform vec2 texelSize;\n"
+    "uniform vec4 viewBounds;\n"
+    "uniform vec4 litColor;\n"
+    "uniform vec4 bgColor;\n"
+    "float Code(vec4 pixel)\n"
+    "{\n"
+    "    return floor(pixel.r*255.0 + 0.5);\n"
+    "}\n"
+    "bool HasFlag(float code, float flag)\n"
+    "{\n"
+    "    return mod(floor(code/flag), 2.0) == 1.0;\n"
+    "}\n"
+    "float Depth(vec4 pixel)\n"
+    "{\n"
+    "    return (Code(pixel) == 0.0)? 65536.0 : pixel.b*65280.0 + pixel.a*255.0;\n"
+    "}\n"
+    "void FindEdge(vec4 pixel, vec2 offset, bool before, inout float edge_depth, inout bool edge_lit)\n"
+    "{\n"
+    "    vec4 neighbor = texture2D(texture0, clamp(fragTexCoord + offset*texelSize, viewBounds.xy, viewBounds.zw));\n"
+    "    float code = Code(neighbor);\n"
+    "    float depth = Depth(neighbor);\n"
+    "    if (!HasFlag(code, 4.0) || depth >= edge_depth) return;\n"
+    "    float pixel_depth = Depth(pixel);\n"
+    "    bool same = neighbor.g == pixel.g && mod(code, 8.0) == mod(Code(pixel), 8.0);\n"
+    "    if (same? code != Code(pixel) && before : depth < pixel_depth || (depth == pixel_depth && before))\n"
+    "    {\n"
+    "        edge_depth = depth;\n"
+    "        edge_lit = !HasFlag(code, 2.0);\n"
+    "    }\n"
+    "}\n"
+    "void main()\n"
+    "{\n"
+    "    vec4 pixel = texture2D(texture0, fragTexCoord);\n"
+    "    float code = Code(pixel);\n"
+    "    float edge_depth = 65536.0;\n"
+    "    bool edge_lit = false;\n"
+    "    FindEdge(pixel, vec2(-1.0, 0.0), true, edge_depth, edge_lit);\n"
+    "    FindEdge(pixel, vec2(0.0, -1.0), true, edge_depth, edge_lit);\n"
+    "    FindEdge(pixel, vec2(1.0, 0.0), false, edge_depth, edge_lit);\n"
+    "    FindEdge(pixel, vec2(0.0, 1.0), false, edge_depth, edge_lit);\n"
+    "    if (edge_depth < 65536.0) FRAG_COLOR = edge_lit? litColor : bgColor;\n"
+    "    else if (code == 0.0) discard;\n"
+    "    else FRAG_COLOR = HasFlag(code, 2.0)? litColor : bgColor;\n"
+    "}\n";
 
 //----------------------------------------------------------------------------------
 // Module Variables Definition (local)
@@ -62,372 +256,483 @@ static Texture2D textureBackground[LEVEL_COUNT];
 static Sound fxBreak;
 static Sound fxGrab;
 
-typedef struct
-{
-    float ang, ang_spd;
-
-    Vector3 pos, pos_spd;
+static Level *level;
+static Replay replay;
+static float *trafficXs, *trafficZs;   // Where the moving hazards are drawn
 
-    float turbo_l, turbo_r;
+// Pods of the race: the one of this game first, then the rival or the other split screen players
+static RaceState race;
+static int viewsCount = 1;      // Pods with a view of their own, the screen is split if more than one
+static bool podDone[RACE_MAX_PLAYERS];
 
-    int time_death;
-} Player;
+static Ghost ghost;             // Record run of the level, if there is one
+static bool ghostLoaded = false;
+static Ghost ghostRun;          // Trajectory of this race
 
+// Parts of the obstacles, each drawn with one instanced draw call for all the obstacles in view
 typedef enum
 {
-    OBSTACLE_BUILDING,
-    OBSTACLE_TREE,
-    OBSTACLE_LAMP,
-    OBSTACLE_IGLOO,
-} ObstacleType;
-
-static const float OBSTACLE_RAD[] = {
-    0.5,
-    0.2,
-    0.125,
-    1.0,
-};
-
+    PART_BUILDING,
+    PART_TRUNK,
+    PART_CROWN,
+    PART_POLE,
+    PART_LAMP_HEAD,
+    PART_LIGHT,
+    PART_LIGHT_FAR,
+    PART_IGLOO,
+    PART_IGLOO_TOP,
+    PART_COUNT,
+} ObstaclePart;
+
+static bool instancing = false;         // Obstacles drawn with instancing, immediate mode otherwise
+static Shader obstacleShader;
+static Material obstacleMaterial;
+static int edgeWidthLoc;
+static Mesh meshCube, meshLight, meshLightFar;
+
+static bool outlining = false;          // Views drawn with the outline pass
+static RenderTexture2D sceneTarget;
+static Shader sceneShader;
+static Material sceneMaterial;          // Instanced obstacle parts on the outline pass
+static Shader outlineShader;
+static int partFlagsLoc, viewBoundsLoc;
+static int sceneObjectId = 0;           // Last identifier given to immediate mode geometry
+
+static bool snowOn = false;
+static Mesh snowMesh;                   // A quad facing the camera for each flake
+static Material snowMaterial;
+static float snowX[SNOW_FLAKES], snowZ[SNOW_FLAKES];   // Where on the tile
+static float snowHeight[SNOW_FLAKES], snowRate[SNOW_FLAKES];  // Fall height and its inverse
+static float snowPhase[SNOW_FLAKES];
+
+// Obstacles of the view that passed culling, drawn at the end of the view if they are visible
 typedef struct
 {
-    ObstacleType type;
-    Vector3 pos;
-} Obstacle;
+    Obstacle obj;
+    int id;
+    bool detailed;
+    bool visible;
+    float side0, side1;         // Horizontal extent seen from the camera, by MarkVisibleObstacles
+    float near, far;
+} ViewObstacle;
 
 typedef struct
 {
-    Obstacle *objs;
-    unsigned int objs_count;
-
-    int n_carrots;
-    Vector3 carrot_pos;
-    int carrot_grab_anim;
-
-    int time_playing;
-
-    int map_size;
-} Level;
+    float near;
+    int index;
+} OcclusionOrder;
+
+static ViewObstacle *viewObstacles;
+static OcclusionOrder *occlusionOrder;  // View obstacles sorted front to back
+static int viewObstaclesCount, viewObstaclesCapacity;
+static float occlusionHorizon[OCCLUSION_MAX_SLICES];   // Rise over distance hidden on each slice
+
+static Matrix *partInstances[PART_COUNT];
+static int partCount[PART_COUNT];
+static int partCapacity[PART_COUNT];
+
+static Netplay netplay;
+static bool netplayOn = false;  // Racing against a rival game
+static bool waitingRival = false;
+
+// Distances the views are drawn to, kept between races
+static float renderDistance = 0;
+static float lodDistance = 0;
+static float drawTimeAverage = 0;   // Seconds, over the last frames
+static int framesSinceAdapt = 0;
+
+// The race is simulated at SIM_FPS however often frames are drawn, the pods are drawn between
+// their last two simulated states
+static float simAccumulator = 0;
+static float simAlpha = 1;
+static RaceState prevRace;
 
 //----------------------------------------------------------------------------------
 // Gameplay Screen Functions Definition
 //----------------------------------------------------------------------------------
 
-static float fremf(float a, float b)
+static void DrawTile(Texture2D tex, int tile_size_x, int tile_size_y, int tile_x, int tile_y,
+        int pos_x, int pos_y)
 {
-    float r = fmodf(a, b);
-    return r < 0 ? r + b : r;
-}
+    int ntiles_x = tex.width/tile_size_x;
+    int ntiles_y = tex.height/tile_size_y;
 
-static bool LevelCheckCollision(const Level *level, Vector3 point, float rad)
-{
-    for (int i = 0; i < level->objs_count; ++i)
-    {
-        float obj_rad = OBSTACLE_RAD[level->objs[i].type];
+    if (tile_x < 0) tile_x = 0;
+    if (tile_x >= ntiles_x) tile_x = ntiles_x - 1;
+    if (tile_y < 0) tile_y = 0;
+    if (tile_y >= ntiles_y) tile_y = ntiles_y - 1;
 
-        if (point.x + rad <= level->objs[i].pos.x - obj_rad)
-            continue;
-        if (point.x - rad >= level->objs[i].pos.x + obj_rad)
-            continue;
-        if (point.z + rad <= level->objs[i].pos.z - obj_rad)
-            continue;
-        if (point.z - rad >= level->objs[i].pos.z + obj_rad)
-            continue;
+    Rectangle src = {tile_size_x*tile_x, tile_size_y*tile_y, tile_size_x, tile_size_y};
 
-        return true;
-    }
-    return false;
+    gameplayStats.drawCalls++;
+
+    DrawTextureRec(tex, src, (Vector2){pos_x, pos_y}, WHITE);
 }
 
-static void LevelRespawnCarrot(Level *level, const Player *player)
+static void DrawTextOutline(int pos_x, int pos_y, const char *text)
 {
-    const int REGULAR_ATTEMTPS = 10000;
-
-    int attempts = 0;
-    assert(CARROT_SPAN_DIST < 0.9 * level->map_size);
-
-    while(1)
+    for (int x = -1; x <= 1; ++x)
     {
-        float angle = 2*PI*(rand() % 30000)/30000.0f;
-        float distance = CARROT_SPAN_DIST;
-
-        if (attempts > REGULAR_ATTEMTPS)
-            distance = CARROT_SPAN_DIST + ((attempts - REGULAR_ATTEMTPS)/10)%CARROT_SPAN_DIST;
-
-        float pos_x = player->pos.x + distance * cosf(angle);
-        float pos_z = player->pos.z + distance * sinf(angle);
-
-        if (0 < pos_x && pos_x < level->map_size && 0 < pos_z && pos_z < level->map_size)
+        for (int y = -1; y <= 1; ++y)
         {
-            level->carrot_pos = (Vector3){pos_x, 0, pos_z};
-
-            if (!LevelCheckCollision(level, level->carrot_pos, 2))
-                break;
+            if (x == 0 && y == 0)
+                continue;
+            DrawText(text, pos_x - x, pos_y - y, UI_FONT_SIZE, SCREEN_COLOR_LIT);
         }
-        attempts++;
     }
-    level->carrot_grab_anim = 0;
+    gameplayStats.drawCalls += 9;
+    DrawText(text, pos_x, pos_y, UI_FONT_SIZE, SCREEN_COLOR_BG);
+}
+
+// Color of 3D geometry drawn in immediate mode, lit or not. On the outline pass, the color codes
+// the SCENE_* flags of the geometry and a new object identifier instead.
+static Color SceneColor(bool lit, bool bordered)
+{
+    if (!outlining)
+        return lit? SCREEN_COLOR_LIT : SCREEN_COLOR_BG;
+
+    sceneObjectId = (sceneObjectId + 1)%256;
+
+    int flags = SCENE_DRAWN | (lit? SCENE_LIT : 0) | (bordered? SCENE_BORDERED : 0);
+    return (Color){flags, sceneObjectId, 0, 255};
 }
 
-static Level *LevelGenerate()
+// Moves the flakes to where they are around the camera at the given time, in simulation steps,
+// and draws them all with one draw call
+static void DrawSnow(Camera camera, float view_height, float time)
 {
-    Level *level = MemAlloc(sizeof(*level));
-    assert(level);
+    Vector3 front = Vector3Normalize(Vector3Subtract(camera.target, camera.position));
+    Vector3 right = Vector3Normalize(Vector3CrossProduct(front, camera.up));
+    Vector3 up = Vector3CrossProduct(right, front);
 
-    level->objs = MemAlloc(sizeof(*level->objs) * N_MAP_OBSTACLES);
-    level->objs_count = 0;
+    // Far flakes are kept a pixel wide, like points
+    const float pixel = 2*tanf(camera.fovy*0.5f*DEG2RAD)/view_height;
+    const float fall = SNOW_SPEED*time;
+    const Vector3 cam = camera.position;
 
-    level->map_size = MAP_SIZE;
-    if (currentLevel == LEVEL_FOREST)
-        level->map_size = MAP_SIZE_FOREST;
+    // Where the camera is on its tile, the flakes are wrapped to the tile centered on it
+    const float cam_tile_x = cam.x - SNOW_TILE*floorf(cam.x/SNOW_TILE);
+    const float cam_tile_z = cam.z - SNOW_TILE*floorf(cam.z/SNOW_TILE);
 
+    float *vertices = snowMesh.vertices;
 
-    for (int i = 0; i < N_MAP_OBSTACLES; ++i)
+    // Kept free of branches and calls, so the compiler can vectorize it
+    for (int i = 0; i < SNOW_FLAKES; ++i)
     {
-        Obstacle obs = {0};
+        // Both are on a tile, so dx/SNOW_TILE + 1.5 is in (0.5, 2.5] and truncating it floors it
+        float dx = snowX[i] - cam_tile_x;
+        float dz = snowZ[i] - cam_tile_z;
+        dx -= SNOW_TILE*((int) (dx/SNOW_TILE + 1.5f) - 1);
+        dz -= SNOW_TILE*((int) (dz/SNOW_TILE + 1.5f) - 1);
+
+        float cycle = fall*snowRate[i] + snowPhase[i];
+        float y = snowHeight[i]*(1 - (cycle - (int) cycle));
+        float dy = y - cam.y;
+
+        float size = (dx*front.x + dy*front.y + dz*front.z)*pixel;
+        float half = 0.25f*(size + SNOW_FLAKE_SIZE + fabsf(size - SNOW_FLAKE_SIZE));   // Half the largest
+        float x = cam.x + dx;
+        float z = cam.z + dz;
+        float *v = &vertices[12*i];
+
+        v[0] = x + half*(-right.x - up.x);
+        v[1] = y + half*(-right.y - up.y);
+        v[2] = z + half*(-right.z - up.z);
+        v[3] = x + half*(right.x - up.x);
+        v[4] = y + half*(right.y - up.y);
+        v[5] = z + half*(right.z - up.z);
+        v[6] = x + half*(right.x + up.x);
+        v[7] = y + half*(right.y + up.y);
+        v[8] = z + half*(right.z + up.z);
+        v[9] = x + half*(-right.x + up.x);
+        v[10] = y + half*(-right.y + up.y);
+        v[11] = z + half*(-right.z + up.z);
+    }
 
-        while (1)
-        {
-            int pos_x = rand()%level->map_size;
-            int pos_z = rand()%level->map_size;
-
-            obs.pos.x = pos_x;
-            obs.pos.y = 0;
-            obs.pos.z = pos_z;
-
-            if (currentLevel == LEVEL_CITY)
-                obs.type = OBSTACLE_BUILDING;
-            if (currentLevel == LEVEL_FOREST)
-                obs.type = OBSTACLE_TREE;
-            else if (currentLevel == LEVEL_LIGHTS)
-                obs.type = OBSTACLE_LAMP;
-            else if (currentLevel == LEVEL_ICE)
-                obs.type = OBSTACLE_IGLOO;
-
-            if (obs.type == OBSTACLE_TREE)
-            {
-                obs.pos.x += (rand()%11 - 5)/7.0;
-                obs.pos.y += (rand()%11 - 5)/7.0;
-            }
+    UpdateMeshBuffer(snowMesh, 0, vertices, sizeof(float)*3*snowMesh.vertexCount, 0);
+    DrawMesh(snowMesh, snowMaterial, MatrixIdentity());
+    gameplayStats.drawCalls++;
+}
 
-            if (!LevelCheckCollision(level, obs.pos, 0.8 * OBSTACLE_RAD[currentLevel]))
-                break;
-        }
+// Pod of a ghost or a rival, as a wireframe box pointing forward
+static void DrawPodWires(Vector3 pos, float ang)
+{
+    Vector3 center = Vector3Add(pos, (Vector3){0, PLAYER_RAD, 0});
+    Vector3 front = Vector3RotateByAxisAngle((Vector3){2*PLAYER_RAD, 0, 0}, (Vector3){0, 1, 0}, ang);
+    Color color = SceneColor(true, false);
 
-        level->objs[level->objs_count++] = obs;
-    }
+    gameplayStats.drawCalls += 2;
 
-    return level;
+    DrawCubeWires(center, 2*PLAYER_RAD, 2*PLAYER_RAD, 2*PLAYER_RAD, color);
+    DrawLine3D(center, Vector3Add(center, front), color);
 }
 
-static void UnloadLevel(Level *level)
+// Pod of the given player, between its last two simulated frames
+static Player ViewPlayer(int index)
 {
-    MemFree(level->objs);
-    MemFree(level);
+    Player prev = RacePlayer(&prevRace, index);
+    Player next = RacePlayer(&race, index);
+
+    return InterpolatePlayer(&prev, &next, simAlpha);
 }
 
-static void UpdatePlayer(Level *level, Player *player)
+// Takes the pods of a head-to-head race from the netplay one, the local pod first
+static void TakeNetplayPods(void)
 {
-    if (level->n_carrots == TARGET_N_CARROTS)
+    Player local = RacePlayer(&netplay.race, netplay.local);
+    Player remote = RacePlayer(&netplay.race, netplay.remote);
+
+    RaceSetPlayer(&race, 0, &local);
+    RaceSetPlayer(&race, 1, &remote);
+}
+
+// Controls of the given player, from its gamepad. The first player can also use the keyboard.
+static PlayerInput ReadPlayerInput(int index)
+{
+    PlayerInput input = {0};
+
+    // Benchmark races are driven by the autopilot, so they are the same on every machine
+    if (benchmarkMode)
     {
-        player->pos_spd = Vector3Scale(player->pos_spd, 0.95);
-        player->ang_spd *= 0.95;
+        Player pod = RacePlayer(&race, index);
+        return AutopilotInput(level, &pod);
     }
-    else if (player->time_death)
-    {
-        player->time_death++;
 
-        player->pos_spd = Vector3Scale(player->pos_spd, 0.95);
-        player->ang_spd *= 0.95;
-    }
-    else
+    if (index == 0)
     {
-        // React to controls
         if (IsKeyDown(KEY_A) || IsKeyDown(KEY_KP_4))
-            player->turbo_l = 2;
+            input.turbo_l = 2;
         else if (IsKeyDown(KEY_Z) || IsKeyDown(KEY_KP_1))
-            player->turbo_l = 1;
-        else
-            player->turbo_l = 0;
+            input.turbo_l = 1;
 
         if (IsKeyDown(KEY_K) || IsKeyDown(KEY_KP_6))
-            player->turbo_r = 2;
+            input.turbo_r = 2;
         else if (IsKeyDown(KEY_M) || IsKeyDown(KEY_KP_3))
-            player->turbo_r = 1;
-        else
-            player->turbo_r = 0;
+            input.turbo_r = 1;
+    }
 
+    if (IsGamepadAvailable(index) && triggerLeftAxis != -1 && triggerRightAxis != -1)
+    {
+        float turbo_l = GetGamepadAxisMovement(index, triggerLeftAxis) + 1.0f;
+        float turbo_r = GetGamepadAxisMovement(index, triggerRightAxis) + 1.0f;
 
-        if (IsGamepadAvailable(0) && triggerLeftAxis != -1 && triggerRightAxis != -1)
-        {
-            float turbo_l = GetGamepadAxisMovement(0, triggerLeftAxis) + 1.0f;
-            float turbo_r = GetGamepadAxisMovement(0, triggerRightAxis) + 1.0f;
+        if (input.turbo_l < turbo_l)
+            input.turbo_l = turbo_l;
+        if (input.turbo_r < turbo_r)
+            input.turbo_r = turbo_r;
+    }
 
-            if (player->turbo_l < turbo_l)
-                player->turbo_l = turbo_l;
-            if (player->turbo_r < turbo_r)
-                player->turbo_r = turbo_r;
-        }
+    return input;
+}
 
-        // Target velocity
-        float tgt_ang_spd = (player->turbo_r - player->turbo_l) * 0.04;
-        float tgt_front_spd = (player->turbo_l + player->turbo_r - 0.4*absf(player->turbo_r - player->turbo_l)) * 0.1;
-        Vector3 tgt_spd = (Vector3){tgt_front_spd*cosf(player->ang), -10, -tgt_front_spd*sinf(player->ang)};
+// Shader from the GLSL 100 code of its stages, the default vertex shader if vs is NULL
+static Shader LoadGameShader(const char *vs, const char *fs)
+{
+    char vs_code[4096], fs_code[4096];
 
-        // Accelerate towards target velocity (not phyisically accurate at all)
-        player->ang_spd = 0.9 * player->ang_spd + 0.1 * tgt_ang_spd;
-        if (currentLevel == LEVEL_ICE)
-            player->pos_spd = Vector3Add(Vector3Scale(player->pos_spd, 0.98), Vector3Scale(tgt_spd, 0.02));
-        else
-            player->pos_spd = Vector3Add(Vector3Scale(player->pos_spd, 0.9), Vector3Scale(tgt_spd, 0.1));
-    }
+    snprintf(fs_code, sizeof(fs_code), "%s%s", SHADER_FS_HEADER, fs);
+    if (vs == NULL)
+        return LoadShaderFromMemory(NULL, fs_code);
+
+    snprintf(vs_code, sizeof(vs_code), "%s%s", SHADER_VS_HEADER, vs);
+    return LoadShaderFromMemory(vs_code, fs_code);
+}
+
+// Loads the shader and meshes of the obstacle parts, if the platform can draw them instanced
+static void InitObstacleInstancing(void)
+{
+    instancing = false;
 
-    // Collide with floor
-    if (player->pos.y + player->pos_spd.y < 0)
+#if defined(PLATFORM_DESKTOP) || defined(PLATFORM_WEB)
+    obstacleShader = LoadGameShader(OBSTACLE_VS, OBSTACLE_FS);
+    if (obstacleShader.id == rlGetShaderIdDefault())
     {
-        player->pos.y = 0;
-        player->pos_spd.y = 0;
-        if (level->time_playing == 0)
-            level->time_playing = 1;
+        TraceLog(LOG_WARNING, "GAMEPLAY: Could not load the obstacle shader, drawing obstacles one by one");
+        return;
     }
+    obstacleShader.locs[SHADER_LOC_MATRIX_MODEL] = GetShaderLocationAttrib(obstacleShader, "instanceTransform");
+    edgeWidthLoc = GetShaderLocation(obstacleShader, "edgeWidth");
 
-    // Mario Kart 64 collision
-    Vector3 pos_spd_x = (Vector3){player->pos_spd.x, 0, 0};
-    Vector3 pos_spd_z = (Vector3){0, 0, player->pos_spd.z};
+    Vector4 edge_color = ColorNormalize(SCREEN_COLOR_LIT);
+    SetShaderValue(obstacleShader, GetShaderLocation(obstacleShader, "edgeColor"), &edge_color, SHADER_UNIFORM_VEC4);
 
-    Vector3 old_pos_spd = player->pos_spd;
+    obstacleMaterial = LoadMaterialDefault();
+    obstacleMaterial.shader = obstacleShader;
 
-    if (LevelCheckCollision(level, Vector3Add(player->pos, player->pos_spd), PLAYER_RAD))
-    {
+    meshCube = GenMeshCube(1, 1, 1);
+    meshLight = GenMeshPoly(15, 4);
+    meshLightFar = GenMeshPoly(5, 4);
 
-        // Remove one speed component
-        if (absf(player->pos_spd.x) >= absf(player->pos_spd.y))
-        {
-            if (LevelCheckCollision(level, Vector3Add(player->pos, pos_spd_x), PLAYER_RAD))
-                player->pos_spd.x = 0;
-            else if (LevelCheckCollision(level, Vector3Add(player->pos, pos_spd_z), PLAYER_RAD))
-                player->pos_spd.z = 0;
-        }
-        else
-        {
-            if (LevelCheckCollision(level, Vector3Add(player->pos, pos_spd_z), PLAYER_RAD))
-                player->pos_spd.z = 0;
-            else if (LevelCheckCollision(level, Vector3Add(player->pos, pos_spd_x), PLAYER_RAD))
-                player->pos_spd.x = 0;
-        }
+    memset(partCount, 0, sizeof(partCount));
+    instancing = true;
+#endif
+}
 
-        // Halt
-        if (LevelCheckCollision(level, Vector3Add(player->pos, player->pos_spd), PLAYER_RAD))
-        {
-            player->pos_spd.x = 0;
-            player->pos_spd.z = 0;
-        }
+static void UnloadObstacleInstancing(void)
+{
+    if (!instancing)
+        return;
 
-        if (!player->time_death && level->n_carrots < TARGET_N_CARROTS)
-        {
-            // Is collision fatal?
-            float collision_magnitude = Vector3Distance(player->pos_spd, old_pos_spd);
+    UnloadMesh(meshCube);
+    UnloadMesh(meshLight);
+    UnloadMesh(meshLightFar);
 
-            if (collision_magnitude > 0.15)
-            {
-                player->time_death += 1;
-                StopMusicStream(music);
-                PlaySound(fxBreak);
-            }
-        }
-    }
+    // The material unloads its shader
+    UnloadMaterial(obstacleMaterial);
 
-    // Move according to speed
-    player->ang += player->ang_spd;
-    player->ang = fremf(player->ang, 2*PI);
-    player->pos = Vector3Add(player->pos, player->pos_spd);
+    for (int p = 0; p < PART_COUNT; ++p)
+    {
+        MemFree(partInstances[p]);
+        partInstances[p] = NULL;
+        partCapacity[p] = 0;
+    }
+    instancing = false;
 }
 
-static void DrawTile(Texture2D tex, int tile_size_x, int tile_size_y, int tile_x, int tile_y,
-        int pos_x, int pos_y)
+// Loads the shaders and the target of the outline pass, if it was asked for and the platform can use it
+static void InitOutlinePass(void)
 {
-    int ntiles_x = tex.width/tile_size_x;
-    int ntiles_y = tex.height/tile_size_y;
+    outlining = false;
 
-    if (tile_x < 0) tile_x = 0;
-    if (tile_x >= ntiles_x) tile_x = ntiles_x - 1;
-    if (tile_y < 0) tile_y = 0;
-    if (tile_y >= ntiles_y) tile_y = ntiles_y - 1;
+    if (!outlinePass)
+        return;
 
-    Rectangle src = {tile_size_x*tile_x, tile_size_y*tile_y, tile_size_x, tile_size_y};
+    sceneShader = LoadGameShader(SCENE_VS, SCENE_FS);
+    outlineShader = LoadGameShader(NULL, OUTLINE_FS);
 
-    DrawTextureRec(tex, src, (Vector2){pos_x, pos_y}, WHITE);
-}
+    Shader scene_instanced = {0};
+    if (instancing)
+        scene_instanced = LoadGameShader(SCENE_INSTANCED_VS, SCENE_FS);
 
-static void DrawTextOutline(int pos_x, int pos_y, const char *text)
-{
-    for (int x = -1; x <= 1; ++x)
+    unsigned int default_id = rlGetShaderIdDefault();
+    if (sceneShader.id == default_id || outlineShader.id == default_id || (instancing && scene_instanced.id == default_id))
     {
-        for (int y = -1; y <= 1; ++y)
-        {
-            if (x == 0 && y == 0)
-                continue;
-            DrawText(text, pos_x - x, pos_y - y, UI_FONT_SIZE, SCREEN_COLOR_LIT);
-        }
+        TraceLog(LOG_WARNING, "GAMEPLAY: Could not load the outline pass shaders, drawing the edges as lines");
+        UnloadShader(sceneShader);
+        UnloadShader(outlineShader);
+        if (instancing)
+            UnloadShader(scene_instanced);
+        return;
     }
-    DrawText(text, pos_x, pos_y, UI_FONT_SIZE, SCREEN_COLOR_BG);
+
+    if (instancing)
+    {
+        scene_instanced.locs[SHADER_LOC_MATRIX_MODEL] = GetShaderLocationAttrib(scene_instanced, "instanceTransform");
+        partFlagsLoc = GetShaderLocation(scene_instanced, "flags");
+
+        sceneMaterial = LoadMaterialDefault();
+        sceneMaterial.shader = scene_instanced;
+    }
+
+    Vector2 texel_size = {1.0f/SCREEN_W, 1.0f/SCREEN_H};
+    Vector4 lit_color = ColorNormalize(SCREEN_COLOR_LIT);
+    Vector4 bg_color = ColorNormalize(SCREEN_COLOR_BG);
+
+    SetShaderValue(outlineShader, GetShaderLocation(outlineShader, "texelSize"), &texel_size, SHADER_UNIFORM_VEC2);
+    SetShaderValue(outlineShader, GetShaderLocation(outlineShader, "litColor"), &lit_color, SHADER_UNIFORM_VEC4);
+    SetShaderValue(outlineShader, GetShaderLocation(outlineShader, "bgColor"), &bg_color, SHADER_UNIFORM_VEC4);
+    viewBoundsLoc = GetShaderLocation(outlineShader, "viewBounds");
+
+    sceneTarget = LoadRenderTexture(SCREEN_W, SCREEN_H);
+    outlining = true;
 }
 
-void DrawSnow(Camera3D camera, int framesCounter)
+// Places the snow flakes on their tile, and loads the mesh they are drawn with
+static void InitSnow(void)
 {
-    const float SNOW_DISTANCE = 6.0f;
-    const float SNOW_STEP = 0.8f;
+    snowMesh = (Mesh){0};
+    snowMesh.vertexCount = 4*SNOW_FLAKES;
+    snowMesh.triangleCount = 2*SNOW_FLAKES;
+    snowMesh.vertices = MemAlloc(sizeof(float)*3*snowMesh.vertexCount);
+    snowMesh.colors = MemAlloc(sizeof(Color)*snowMesh.vertexCount);
+    snowMesh.indices = MemAlloc(sizeof(unsigned short)*3*snowMesh.triangleCount);
 
-    int cam_x = (int) camera.position.x;
-    int cam_z = (int) camera.position.z;
+    const unsigned short quad[6] = {0, 1, 2, 0, 2, 3};
+    Color color = SceneColor(true, false);
 
-    for (float x = cam_x - SNOW_DISTANCE; x <= cam_x + SNOW_DISTANCE; x += SNOW_STEP)
+    for (int i = 0; i < SNOW_FLAKES; ++i)
     {
-        for (float z = cam_z - SNOW_DISTANCE; z <= cam_z + SNOW_DISTANCE; z += 0.866*SNOW_STEP)
-        {
-            float corr_x = fmodf(x + 1.61803398875*z, 0.6*SNOW_STEP) - 0.3*SNOW_STEP;
-            float corr_z = 0.5 + fmodf(3.1415*x + z, 0.5*SNOW_STEP) - 0.25*SNOW_STEP;
-            float fall_h = 4.0 + fmodf(3.42*x + 11.42*z, 2.0);
-            float pos_h = fall_h - fmodf(0.04*framesCounter + 100, fall_h);
+        snowX[i] = SNOW_TILE*rand()/RAND_MAX;
+        snowZ[i] = SNOW_TILE*rand()/RAND_MAX;
+        snowHeight[i] = SNOW_FALL_MIN + (SNOW_FALL_MAX - SNOW_FALL_MIN)*rand()/RAND_MAX;
+        snowRate[i] = 1/snowHeight[i];
+        snowPhase[i] = (float) rand()/RAND_MAX;
+
+        for (int k = 0; k < 4; ++k)
+            ((Color *) snowMesh.colors)[4*i + k] = color;
+        for (int k = 0; k < 6; ++k)
+            snowMesh.indices[6*i + k] = 4*i + quad[k];
+    }
 
-            float pos_x = x + corr_x;
-            float pos_z = z + corr_z;
+    // Only the vertices change, on each view
+    UploadMesh(&snowMesh, true);
 
-            if (absf(pos_x - cam_x) + absf(pos_z - cam_z) < 4)
-                DrawCube((Vector3){pos_x, pos_h, pos_z}, 0.1, 0.1, 0.1, SCREEN_COLOR_LIT);
-            else
-                DrawPoint3D((Vector3){pos_x, pos_h, pos_z}, SCREEN_COLOR_LIT);
-        }
-    }
+    snowMaterial = LoadMaterialDefault();
+    if (outlining)
+        snowMaterial.shader = sceneShader;
+
+    snowOn = true;
 }
 
-float CarrotAngle(const Level *level, const Player *player)
+static void UnloadSnow(void)
 {
-    float angle = atan2f(- (level->carrot_pos.z - player->pos.z), level->carrot_pos.x - player->pos.x);
-    if (angle < 0)
-        angle += 2*PI;
-
-    float delta = angle - player->ang;
+    if (!snowOn)
+        return;
 
-    if (delta < -PI)
-        return 2*PI + delta;
+    UnloadMesh(snowMesh);
 
-    if (delta > PI)
-        return delta - 2*PI;
+    // The shader is the default one, or the one of the outline pass that is unloaded apart
+    MemFree(snowMaterial.maps);
 
-    return delta;
+    snowOn = false;
 }
 
-float CarrotDistance(const Level *level, const Player *player)
+static void UnloadOutlinePass(void)
 {
-    return Vector3Distance(player->pos, level->carrot_pos);
+    if (!outlining)
+        return;
+
+    UnloadRenderTexture(sceneTarget);
+    UnloadShader(sceneShader);
+    UnloadShader(outlineShader);
+
+    // The material unloads its shader
+    if (instancing)
+        UnloadMaterial(sceneMaterial);
+
+    outlining = false;
 }
 
-//----------------------------------------------------------------------------------
-// Local variables only for Gameplay Screen Functions
-//----------------------------------------------------------------------------------
+// Moves the render and LOD distances towards drawing the views in DRAW_TIME_TARGET. The draw time
+// is the CPU time to submit the views (see DrawPodScene), which grows with what they draw but
+// misses a GPU that falls behind. It is averaged over the last frames, and the distances only
+// change when it is well off the target and a while after the last change, so they don't flicker.
+static void AdaptRenderDistance(float draw_time)
+{
+    drawTimeAverage = (drawTimeAverage == 0)? draw_time : Lerp(drawTimeAverage, draw_time, 0.1f);
 
-static Level *level;
-static Player player;
+    if (++framesSinceAdapt < DISTANCE_ADAPT_FRAMES)
+        return;
+
+    // Shrink faster than grow, dropped frames are worse than a closer horizon
+    float distance = renderDistance;
+
+    if (drawTimeAverage > DRAW_TIME_HIGH*DRAW_TIME_TARGET)
+        distance -= 5;
+    else if (drawTimeAverage < DRAW_TIME_LOW*DRAW_TIME_TARGET)
+        distance += 2.5f;
+
+    distance = Clamp(distance, RENDER_DISTANCE_MIN, RENDER_DISTANCE_MAX);
+    if (distance == renderDistance)
+        return;
+
+    renderDistance = distance;
+    lodDistance = distance*LOD_DISTANCE/RENDER_DISTANCE;
+    framesSinceAdapt = 0;
+
+    TraceLog(LOG_INFO, "GAMEPLAY: Drawing to %.1f, with detail to %.1f (draw time %.2f ms)",
+            renderDistance, lodDistance, 1000*drawTimeAverage);
+}
 
 //----------------------------------------------------------------------------------
 // Gameplay Screen Functions Definition
@@ -444,14 +749,68 @@ void InitGameplayScreen(void)
     textureBackground[1] = LoadTexture("resources/background1.png");
     textureBackground[2] = LoadTexture("resources/background2.png");
     textureBackground[3] = LoadTexture("resources/background3.png");
+    InitObstacleInstancing();
+    InitOutlinePass();
+    if (currentLevel == LEVEL_ICE)
+        InitSnow();
+
+    // Levels get a new layout on every race, unless the player chose to race the record run,
+    // whose ghost is only shown on the level it was raced on. Both games of a head-to-head race
+    // use the same level instead.
+    bool splitScreen = localPlayers > 1;
+    bool netplayRequested = netplayPort > 0 && !benchmarkMode && !splitScreen && !endlessMode;
+
+    ghostLoaded = ghostRace && !benchmarkMode && !netplayRequested && !splitScreen && !endlessMode &&
+            LoadGhost(&ghost, TextFormat("ghost%d.npg", currentLevel)) && ghost.area == currentLevel;
+
+    uint64_t seed = nextLevelSeed;
+    if (seed == 0 && netplayRequested)
+        seed = NETPLAY_SEED;
+    if (seed == 0 && ghostLoaded)
+        seed = ghost.seed;
+    if (seed == 0)
+        seed = ((uint64_t) rand() << 32) ^ rand();
+    nextLevelSeed = 0;
+
+    // Races use fixed-point physics, so their replays verify the same on desktop and web
+    level = endlessMode? LevelGenerateEndless(currentLevel, seed) : LevelGenerate(currentLevel, seed);
+    trafficXs = MemAlloc(sizeof(*trafficXs) * (level->traffic_count + 1));
+    trafficZs = MemAlloc(sizeof(*trafficZs) * (level->traffic_count + 1));
+    level->physics_mode = PHYSICS_FIXED;
+    InitRace(level, &race, localPlayers);
+    viewsCount = localPlayers;
+    memset(podDone, 0, sizeof(podDone));
+    InitReplay(&replay, currentLevel, seed);
+    replay.physics_mode = level->physics_mode;
+    replay.endless = level->endless;
+    InitGhost(&ghostRun, currentLevel, seed);
+
+    netplayOn = netplayRequested && InitNetplay(&netplay, level, netplayPort, netplayRivalPort);
+    if (netplayRequested && !netplayOn)
+        TraceLog(LOG_WARNING, "NETPLAY: Could not open UDP port %d, racing alone", netplayPort);
+    if (netplayOn)
+    {
+        race.players_count = 2;
+        TakeNetplayPods();
+    }
+    waitingRival = false;
+
+    // The chunks around the pods are all there from the start
+    for (int i = 0; i < viewsCount; ++i)
+        LevelStreamChunks(level, (Vector3){race.pos_x[i], 0, race.pos_z[i]}, (2*CHUNK_STREAM_RADIUS + 1)*(2*CHUNK_STREAM_RADIUS + 1));
 
-    level = LevelGenerate();
-    memset(&player, 0, sizeof(player));
-    player.pos.x = -10;
-    player.pos.z = level->map_size/2.0;
-    player.pos.y = 100;
+    prevRace = race;
+    simAccumulator = 0;
+    simAlpha = 1;
 
-    LevelRespawnCarrot(level, &player);
+    // Benchmarks always draw as far, so their times can be compared
+    if (renderDistance == 0 || benchmarkMode)
+    {
+        renderDistance = RENDER_DISTANCE;
+        lodDistance = LOD_DISTANCE;
+    }
+    drawTimeAverage = 0;
+    framesSinceAdapt = 0;
 
     fxBreak = LoadSound("resources/break.mp3");
     fxGrab = LoadSound("resources/grab.mp3");
@@ -459,56 +818,130 @@ void InitGameplayScreen(void)
     PlayMusicStream(music);
 }
 
-// Gameplay Screen Update logic
-void UpdateGameplayScreen(void)
+// Simulates one frame of the race, returns false if it had to wait for the rival
+static bool StepGameplay(void)
 {
-    // Set music volume depending on whether it is on or not
-    SetMusicVolume(music, isMusicOn);
+    // The race is simulated with the controls as the replay stores them
+    PlayerInput inputs[RACE_MAX_PLAYERS] = {0};
+    int events[RACE_MAX_PLAYERS] = {0};
+
+    for (int i = 0; i < viewsCount; ++i)
+        inputs[i] = ReplayQuantizeInput(ReadPlayerInput(i));
+
+    prevRace = race;
+
+    if (netplayOn)
+    {
+        // The race doesn't go on while the rival is too far behind
+        waitingRival = !NetplayUpdate(&netplay, inputs[0], &events[0]);
+        if (waitingRival)
+            return false;
+
+        TakeNetplayPods();
+    }
+    else
+    {
+        UpdateRace(level, &race, inputs, events);
+    }
 
     framesCounter++;
 
-    UpdatePlayer(level, &player);
+    Player pod = RacePlayer(&race, 0);
+
+    ReplayRecord(&replay, inputs[0], &pod);
+    GhostRecord(&ghostRun, framesCounter - 1, &pod);
+
+    for (int i = 0; i < viewsCount; ++i)
+    {
+        if (events[i] & SIM_EVENT_CRASH)
+            PlaySound(fxBreak);
+        if (events[i] & SIM_EVENT_CARROT)
+            PlaySound(fxGrab);
+        if (events[i] & (SIM_EVENT_GAME_OVER | SIM_EVENT_FINISH))
+            podDone[i] = true;
+    }
+
+    // Racing alone, the music stops after a crash and pauses while a carrot is grabbed
+    if (viewsCount == 1)
+    {
+        if (race.time_death[0] > 0)
+            StopMusicStream(music);
+
+        if (events[0] & SIM_EVENT_CARROT)
+            PauseMusicStream(music);
 
-    if (player.time_death >= PLAYER_DEATH_ANIMATION_TIME)
-        finishScreen = 1;
+        if (events[0] & SIM_EVENT_CARROT_END)
+            ResumeMusicStream(music);
+    }
 
-    if (player.time_death > 0)
-        StopMusicStream(music);
+    // The race is over once every pod with a view is done
+    bool done = true;
+    bool complete = false;
 
-    if (CarrotDistance(level, &player) <= PLAYER_RAD + CARROT_RAD)
+    for (int i = 0; i < viewsCount; ++i)
     {
-        level->n_carrots++;
-        LevelRespawnCarrot(level, &player);
-        level->carrot_grab_anim++;
-        PlaySound(fxGrab);
-        PauseMusicStream(music);
+        done = done && podDone[i];
+        complete = complete || race.n_carrots[i] == TARGET_N_CARROTS;
     }
 
-    // Increment the clock
-    if (level->time_playing && level->n_carrots < TARGET_N_CARROTS)
+    if (done)
+        finishScreen = complete ? 2 : 1;
+
+    return true;
+}
+
+// Gameplay Screen Update logic
+void UpdateGameplayScreen(void)
+{
+    // Set music volume depending on whether it is on or not
+    SetMusicVolume(music, isMusicOn);
+
+    // On endless levels, a few chunks are generated each frame ahead of the pods, so the
+    // simulation rarely has to generate one itself
+    for (int i = 0; i < viewsCount; ++i)
+        LevelStreamChunks(level, (Vector3){race.pos_x[i], 0, race.pos_z[i]}, CHUNK_STREAM_BUDGET);
+
+    // Benchmark races take one step per frame, so they are the same on every machine
+    if (benchmarkMode)
     {
-        level->time_playing++;
+        StepGameplay();
+        simAlpha = 1;
+        return;
     }
 
-    if (level->carrot_grab_anim > PLAYER_CARROT_GRAB_ANIMATION_TIME)
+    // The pods fall from high above before the race, seeing the whole level
+    if (race.time_playing[0] != 0)
+        AdaptRenderDistance(gameplayStats.drawTime);
+
+    simAccumulator += GetFrameTime();
+    if (simAccumulator > (float) MAX_STEPS_PER_FRAME/SIM_FPS)
+        simAccumulator = (float) MAX_STEPS_PER_FRAME/SIM_FPS;
+
+    while (simAccumulator >= 1.0f/SIM_FPS && !finishScreen)
     {
-        if (level->n_carrots >= TARGET_N_CARROTS)
+        if (!StepGameplay())
         {
-            finishScreen = 2;
-        }
-        else
-        {
-            ResumeMusicStream(music);
-            level->carrot_grab_anim = 0;
+            // Don't catch up on the time spent waiting
+            simAccumulator = 0;
+            break;
         }
+        simAccumulator -= 1.0f/SIM_FPS;
     }
-    if (level->carrot_grab_anim)
-        level->carrot_grab_anim++;
+
+    simAlpha = Clamp(simAccumulator*SIM_FPS, 0, 1);
 }
 
+// Cube with its edges drawn with the opposite color, the outline pass finds the edges itself
 static void DrawBorderedCube(Vector3 position, float width, float height, float length, bool inv)
 {
-    DrawCube(position, width, height, length, inv? SCREEN_COLOR_LIT : SCREEN_COLOR_BG);
+    gameplayStats.drawCalls++;
+
+    DrawCube(position, width, height, length, SceneColor(inv, true));
+
+    if (outlining)
+        return;
+
+    gameplayStats.drawCalls++;
 
     BoundingBox box;
     box.min.x = position.x - 0.5*width - 0.017;
@@ -523,6 +956,8 @@ static void DrawBorderedCube(Vector3 position, float width, float height, float
 
 static void DrawObstacle(Obstacle obj, int id, bool detailed)
 {
+    gameplayStats.drawnObstacles++;
+
     switch (obj.type)
     {
         case OBSTACLE_BUILDING:
@@ -530,18 +965,20 @@ static void DrawObstacle(Obstacle obj, int id, bool detailed)
         break;
         case OBSTACLE_TREE:
             DrawBorderedCube((Vector3){obj.pos.x , 0.8, obj.pos.z}, 0.4, 1.6, 0.4, false);
-            DrawCube((Vector3){obj.pos.x , 1.4, obj.pos.z}, 1, 1.2 + 0.1 * (id % 4), 1, SCREEN_COLOR_LIT);
+            gameplayStats.drawCalls++;
+            DrawCube((Vector3){obj.pos.x , 1.4, obj.pos.z}, 1, 1.2 + 0.1 * (id % 4), 1, SceneColor(true, false));
         break;
         case OBSTACLE_LAMP:
             DrawBorderedCube((Vector3){obj.pos.x , 0.8, obj.pos.z}, 0.25, 1.6, 0.25, false);
+            gameplayStats.drawCalls++;
             if (detailed)
             {
                 DrawBorderedCube((Vector3){obj.pos.x , 1.3, obj.pos.z}, 0.8, 0.2, 0.8, false);
-                DrawCylinder(obj.pos, 4, 4, 0, 15, SCREEN_COLOR_BG);
+                DrawCylinder(obj.pos, 4, 4, 0, 15, SceneColor(false, false));
             }
             else
             {
-                DrawCylinder(obj.pos, 4, 4, 0, 5, SCREEN_COLOR_BG);
+                DrawCylinder(obj.pos, 4, 4, 0, 5, SceneColor(false, false));
             }
         break;
         case OBSTACLE_IGLOO:
@@ -552,88 +989,729 @@ static void DrawObstacle(Obstacle obj, int id, bool detailed)
     }
 }
 
-// Gameplay Screen Draw logic
-void DrawGameplayScreen(void)
+// Adds an instance of a part, a unit mesh scaled by size and moved to pos
+static void AddPartInstance(ObstaclePart part, Vector3 pos, Vector3 size)
+{
+    // The arrays only grow on the first frames of a level
+    if (partCount[part] == partCapacity[part])
+    {
+        partCapacity[part] = maxi(2*partCapacity[part], 256);
+        partInstances[part] = MemRealloc(partInstances[part], sizeof(Matrix) * partCapacity[part]);
+    }
+
+    partInstances[part][partCount[part]++] = (Matrix){
+        .m0 = size.x, .m5 = size.y, .m10 = size.z, .m15 = 1,
+        .m12 = pos.x, .m13 = pos.y, .m14 = pos.z,
+    };
+}
+
+// Like DrawObstacle, but adding the parts of the obstacle to the next DrawObstacleInstances
+static void AddObstacleInstances(Obstacle obj, int id, bool detailed)
+{
+    gameplayStats.drawnObstacles++;
+
+    switch (obj.type)
+    {
+        case OBSTACLE_BUILDING:
+            AddPartInstance(PART_BUILDING, (Vector3){obj.pos.x, 1, obj.pos.z}, (Vector3){1, 2, 1});
+        break;
+        case OBSTACLE_TREE:
+            AddPartInstance(PART_TRUNK, (Vector3){obj.pos.x, 0.8, obj.pos.z}, (Vector3){0.4, 1.6, 0.4});
+            AddPartInstance(PART_CROWN, (Vector3){obj.pos.x, 1.4, obj.pos.z}, (Vector3){1, 1.2 + 0.1 * (id % 4), 1});
+        break;
+        case OBSTACLE_LAMP:
+            AddPartInstance(PART_POLE, (Vector3){obj.pos.x, 0.8, obj.pos.z}, (Vector3){0.25, 1.6, 0.25});
+            if (detailed)
+            {
+                AddPartInstance(PART_LAMP_HEAD, (Vector3){obj.pos.x, 1.3, obj.pos.z}, (Vector3){0.8, 0.2, 0.8});
+                AddPartInstance(PART_LIGHT, obj.pos, (Vector3){1, 1, 1});
+            }
+            else
+            {
+                AddPartInstance(PART_LIGHT_FAR, obj.pos, (Vector3){1, 1, 1});
+            }
+        break;
+        case OBSTACLE_IGLOO:
+            AddPartInstance(PART_IGLOO, (Vector3){obj.pos.x, 0.75, obj.pos.z}, (Vector3){2, 1.5, 2});
+            if (detailed)
+                AddPartInstance(PART_IGLOO_TOP, (Vector3){obj.pos.x, 1.6, obj.pos.z}, (Vector3){1.8, 0.2, 1.8});
+        break;
+    }
+}
+
+// Draws the parts added since the last call, one draw call per part
+static void DrawObstacleInstances(void)
+{
+    for (int p = 0; p < PART_COUNT; ++p)
+    {
+        if (partCount[p] == 0)
+            continue;
+
+        Mesh mesh = meshCube;
+        bool lit = false;
+        bool bordered = true;
+
+        if (p == PART_CROWN)
+        {
+            lit = true;
+            bordered = false;
+        }
+        if (p == PART_LIGHT || p == PART_LIGHT_FAR)
+        {
+            mesh = (p == PART_LIGHT)? meshLight : meshLightFar;
+            bordered = false;
+        }
+
+        if (outlining)
+        {
+            float flags = SCENE_DRAWN | (lit? SCENE_LIT : 0) | (bordered? SCENE_BORDERED : 0);
+
+            SetShaderValue(sceneMaterial.shader, partFlagsLoc, &flags, SHADER_UNIFORM_FLOAT);
+            DrawMeshInstanced(mesh, sceneMaterial, partInstances[p], partCount[p]);
+        }
+        else
+        {
+            float edge_width = bordered? 1 : 0;
+
+            obstacleMaterial.maps[MATERIAL_MAP_DIFFUSE].color = lit? SCREEN_COLOR_LIT : SCREEN_COLOR_BG;
+            SetShaderValue(obstacleShader, edgeWidthLoc, &edge_width, SHADER_UNIFORM_FLOAT);
+            DrawMeshInstanced(mesh, obstacleMaterial, partInstances[p], partCount[p]);
+        }
+        gameplayStats.drawCalls++;
+
+        partCount[p] = 0;
+    }
+}
+
+// Moving hazard going along x or z: a car on the city, a seal on the ice
+static void DrawHazard(float x, float z, bool along_x, bool detailed)
+{
+    gameplayStats.drawnObstacles++;
+
+    float length = along_x? 0.7 : 0.5;
+    float width = along_x? 0.5 : 0.7;
+
+    if (currentLevel == LEVEL_ICE)
+    {
+        DrawBorderedCube((Vector3){x, 0.12, z}, length, 0.24, width, true);
+    }
+    else
+    {
+        DrawBorderedCube((Vector3){x, 0.2, z}, length, 0.3, width, false);
+        if (detailed)
+            DrawBorderedCube((Vector3){x, 0.45, z}, 0.4*length, 0.2, 0.4*width, false);
+    }
+}
+
+// Camera following the pod from behind
+static Camera PodCamera(const Player *view)
 {
     const float camera_y = 0.8;
     const float camera_d = 3.0;
     const float camera_behind = 1.0;
 
-    Vector3 player_pointing = Vector3RotateByAxisAngle((Vector3){1,0,0}, (Vector3){0,1,0}, player.ang);
+    Vector3 player_pointing = Vector3RotateByAxisAngle((Vector3){1,0,0}, (Vector3){0,1,0}, view->ang);
 
     Camera camera = { 0 };
-    camera.position = Vector3Subtract(Vector3Add(player.pos, (Vector3){0, camera_y, 0}), Vector3Scale(player_pointing, camera_behind));
-    camera.target = Vector3Add(player.pos, Vector3Scale(player_pointing, camera_d));
+    camera.position = Vector3Subtract(Vector3Add(view->pos, (Vector3){0, camera_y, 0}), Vector3Scale(player_pointing, camera_behind));
+    camera.target = Vector3Add(view->pos, Vector3Scale(player_pointing, camera_d));
     camera.up = (Vector3){0, 1, 0};
     camera.fovy = 45.0f;
     camera.projection = CAMERA_PERSPECTIVE;
 
+    return camera;
+}
+
+// Like BeginMode3D, but drawing on the given part of the screen, with its aspect ratio
+static void BeginViewMode3D(Camera camera, Rectangle rect)
+{
+    rlDrawRenderBatchActive();
+    rlViewport(rect.x, SCREEN_H - rect.y - rect.height, rect.width, rect.height);
+
+    BeginMode3D(camera);
+
+    double top = RL_CULL_DISTANCE_NEAR*tan(camera.fovy*0.5*DEG2RAD);
+    double right = top*rect.width/rect.height;
+
+    rlMatrixMode(RL_PROJECTION);
+    rlLoadIdentity();
+    rlFrustum(-right, right, -top, top, RL_CULL_DISTANCE_NEAR, RL_CULL_DISTANCE_FAR);
+    rlMatrixMode(RL_MODELVIEW);
+}
+
+static void EndViewMode3D(void)
+{
+    EndMode3D();
+    rlViewport(0, 0, SCREEN_W, SCREEN_H);
+}
+
+// Starts drawing the 3D scene of a view on the target of the outline pass, the codes of its
+// pixels are written as they are
+static void BeginOutlinePass(void)
+{
+    BeginTextureMode(sceneTarget);
+    ClearBackground(BLANK);
+    rlDisableColorBlend();
+    BeginShaderMode(sceneShader);
+}
+
+// Draws the scene of the view on its part of the screen, with the edges of the bordered geometry
+static void EndOutlinePass(Rectangle rect)
+{
+    EndShaderMode();
+    rlEnableColorBlend();
+    EndTextureMode();
+
+    BeginTextureMode(nokiaScreen);
+
+    // The neighbors of the pixels on the sides of the view are taken from inside it
+    Vector4 bounds = {
+        (rect.x + 0.5f)/SCREEN_W, (SCREEN_H - rect.y - rect.height + 0.5f)/SCREEN_H,
+        (rect.x + rect.width - 0.5f)/SCREEN_W, (SCREEN_H - rect.y - 0.5f)/SCREEN_H,
+    };
+    SetShaderValue(outlineShader, viewBoundsLoc, &bounds, SHADER_UNIFORM_VEC4);
+
+    BeginShaderMode(outlineShader);
+        Rectangle src = {rect.x, SCREEN_H - rect.y - rect.height, rect.width, -rect.height};
+        DrawTexturePro(sceneTarget.texture, src, rect, (Vector2){0, 0}, 0, WHITE);
+    EndShaderMode();
+    gameplayStats.drawCalls++;
+}
+
+// Planes of the view of a camera, with the normals pointing inside
+typedef struct
+{
+    Vector3 normal[5];
+    float d[5];
+} ViewFrustum;
+
+// Near plane and side planes of the view of the camera on a viewport with the given aspect ratio.
+// There is no far plane, distances are checked apart.
+static ViewFrustum CameraFrustum(Camera camera, float aspect)
+{
+    Vector3 front = Vector3Normalize(Vector3Subtract(camera.target, camera.position));
+    Vector3 right = Vector3Normalize(Vector3CrossProduct(front, camera.up));
+    Vector3 up = Vector3CrossProduct(right, front);
+
+    float tan_v = tanf(camera.fovy*0.5f*DEG2RAD);
+    float tan_h = tan_v*aspect;
+
+    ViewFrustum frustum;
+    frustum.normal[0] = front;
+    frustum.normal[1] = Vector3Normalize(Vector3Add(Vector3Scale(front, tan_h), right));
+    frustum.normal[2] = Vector3Normalize(Vector3Subtract(Vector3Scale(front, tan_h), right));
+    frustum.normal[3] = Vector3Normalize(Vector3Add(Vector3Scale(front, tan_v), up));
+    frustum.normal[4] = Vector3Normalize(Vector3Subtract(Vector3Scale(front, tan_v), up));
+
+    for (int i = 0; i < 5; ++i)
+        frustum.d[i] = -Vector3DotProduct(frustum.normal[i], camera.position);
+
+    return frustum;
+}
+
+// Whether a part of the box may be in view
+static bool FrustumHasBox(const ViewFrustum *frustum, BoundingBox box)
+{
+    for (int i = 0; i < 5; ++i)
+    {
+        Vector3 n = frustum->normal[i];
+
+        // Corner of the box furthest inside the plane
+        Vector3 corner = {
+            (n.x >= 0)? box.max.x : box.min.x,
+            (n.y >= 0)? box.max.y : box.min.y,
+            (n.z >= 0)? box.max.z : box.min.z,
+        };
+
+        if (Vector3DotProduct(n, corner) + frustum->d[i] < 0)
+            return false;
+    }
+    return true;
+}
+
+// Whether a part of the sphere may be in view
+static bool FrustumHasSphere(const ViewFrustum *frustum, Vector3 center, float rad)
+{
+    for (int i = 0; i < 5; ++i)
+    {
+        if (Vector3DotProduct(frustum->normal[i], center) + frustum->d[i] < -rad)
+            return false;
+    }
+    return true;
+}
+
+static void AddViewObstacle(Obstacle obj, int id, bool detailed)
+{
+    // The array only grows on the first frames of a level
+    if (viewObstaclesCount == viewObstaclesCapacity)
+    {
+        viewObstaclesCapacity = maxi(2*viewObstaclesCapacity, 256);
+        viewObstacles = MemRealloc(viewObstacles, sizeof(*viewObstacles) * viewObstaclesCapacity);
+        occlusionOrder = MemRealloc(occlusionOrder, sizeof(*occlusionOrder) * viewObstaclesCapacity);
+    }
+
+    viewObstacles[viewObstaclesCount++] = (ViewObstacle){.obj = obj, .id = id, .detailed = detailed, .visible = true};
+}
+
+// Horizontal extent of a square seen from the camera, as the sides over the distance ahead of
+// its corners, and its least and greatest distance. False if it is not all ahead of the camera.
+static bool SquareExtent(Vector3 camera, Vector3 ahead, Vector3 right, Vector3 center, float half, float *side0, float *side1, float *near, float *far)
+{
+    *side0 = INFINITY;
+    *side1 = -INFINITY;
+    *far = 0;
+
+    for (int k = 0; k < 4; ++k)
+    {
+        Vector3 corner = {center.x + ((k & 1)? half : -half) - camera.x, 0, center.z + ((k & 2)? half : -half) - camera.z};
+        float forward = Vector3DotProduct(corner, ahead);
+
+        if (forward < 0.01f)
+            return false;
+
+        float side = Vector3DotProduct(corner, right)/forward;
+
+        *side0 = fminf(*side0, side);
+        *side1 = fmaxf(*side1, side);
+        *far = fmaxf(*far, sqrtf(corner.x*corner.x + corner.z*corner.z));
+    }
+
+    float dx = fmaxf(absf(center.x - camera.x) - half, 0);
+    float dz = fmaxf(absf(center.z - camera.z) - half, 0);
+
+    *near = sqrtf(dx*dx + dz*dz);
+    return true;
+}
+
+static int CompareOcclusionOrder(const void *a, const void *b)
+{
+    float near_a = ((const OcclusionOrder *) a)->near;
+    float near_b = ((const OcclusionOrder *) b)->near;
+
+    return (near_a > near_b) - (near_a < near_b);
+}
+
+// Marks which view obstacles can be seen, keeping for narrow slices of the view the line from the
+// camera over which things are hidden. Obstacles are solid down to the ground and the camera is
+// below the top of the occluders, so an occluder that fills a slice hides everything after it that
+// is below the line from the camera to its top. Obstacles are gone through front to back, each one
+// is visible if it is over the line on any slice it touches.
+static void MarkVisibleObstacles(Camera camera, Rectangle rect)
+{
+    const float eps = 0.01f;
+
+    Vector3 front = Vector3Normalize(Vector3Subtract(camera.target, camera.position));
+    Vector3 right = Vector3Normalize(Vector3CrossProduct(front, camera.up));
+    Vector3 up = Vector3CrossProduct(right, front);
+    Vector3 ahead = Vector3Normalize((Vector3){front.x, 0, front.z});
+
+    float cy = camera.position.y;
+    float tan_v = tanf(camera.fovy*0.5f*DEG2RAD);
+    float tan_h = tan_v*rect.width/rect.height;
+
+    // Pixels on the top and bottom rows look further to the sides when seen from above
+    float forward_min = Vector3DotProduct(front, ahead) - tan_v*absf(Vector3DotProduct(up, ahead));
+
+    if (cy <= eps || cy >= OCCLUDER_TOP[OBSTACLE_BUILDING] - 0.1f || forward_min < 0.1f)
+        return;
+
+    float side_max = tan_h/forward_min;
+    int slices = mini(OCCLUSION_SLICES_PER_COLUMN*(int) rect.width, OCCLUSION_MAX_SLICES);
+    float slice_size = 2*side_max/slices;
+
+    for (int k = 0; k < slices; ++k)
+        occlusionHorizon[k] = -INFINITY;
+
+    // Obstacles that are not all ahead of the camera are always drawn
+    int count = 0;
+
+    for (int i = 0; i < viewObstaclesCount; ++i)
+    {
+        ViewObstacle *obs = &viewObstacles[i];
+
+        if (SquareExtent(camera.position, ahead, right, obs->obj.pos, OBSTACLE_VIEW_HALF[obs->obj.type], &obs->side0, &obs->side1, &obs->near, &obs->far))
+            occlusionOrder[count++] = (OcclusionOrder){obs->near, i};
+    }
+    qsort(occlusionOrder, count, sizeof(*occlusionOrder), CompareOcclusionOrder);
+
+    // Occluders that may still be in front of the next obstacles
+    struct { float far, slope; int slice0, slice1; } pending[OCCLUSION_PENDING];
+    int pending_count = 0;
+
+    for (int n = 0; n < count; ++n)
+    {
+        ViewObstacle *obs = &viewObstacles[occlusionOrder[n].index];
+
+        for (int p = 0; p < pending_count; )
+        {
+            if (pending[p].far <= obs->near)
+            {
+                for (int k = pending[p].slice0; k <= pending[p].slice1; ++k)
+                    occlusionHorizon[k] = fmaxf(occlusionHorizon[k], pending[p].slope);
+                pending[p] = pending[--pending_count];
+            }
+            else ++p;
+        }
+
+        // Highest rise over distance to the top of the obstacle, on the slices it touches
+        float top = OBSTACLE_VIEW_TOP[obs->obj.type] - cy;
+        float slope = top/((top >= 0)? fmaxf(obs->near, eps) : obs->far);
+        int slice0 = maxi((int) floorf((obs->side0 + side_max)/slice_size), 0);
+        int slice1 = mini((int) floorf((obs->side1 + side_max)/slice_size), slices - 1);
+
+        obs->visible = false;
+        for (int k = slice0; k <= slice1 && !obs->visible; ++k)
+            obs->visible = slope > occlusionHorizon[k];
+
+        // Slices all inside the occluder
+        float half = OCCLUDER_HALF[obs->obj.type];
+        float side0, side1, near, far;
+
+        if (half > 0 && pending_count < OCCLUSION_PENDING &&
+                SquareExtent(camera.position, ahead, right, obs->obj.pos, half, &side0, &side1, &near, &far))
+        {
+            slice0 = maxi((int) ceilf((side0 + side_max)/slice_size), 0);
+            slice1 = mini((int) floorf((side1 + side_max)/slice_size) - 1, slices - 1);
+
+            if (slice0 <= slice1)
+            {
+                pending[pending_count].far = far;
+                pending[pending_count].slope = (OCCLUDER_TOP[obs->obj.type] - cy)/far;
+                pending[pending_count].slice0 = slice0;
+                pending[pending_count++].slice1 = slice1;
+            }
+        }
+    }
+}
+
+// Draws the visible view obstacles
+static void DrawViewObstacles(void)
+{
+    for (int i = 0; i < viewObstaclesCount; ++i)
+    {
+        const ViewObstacle *obs = &viewObstacles[i];
+
+        if (!obs->visible)
+            continue;
+
+        if (instancing)
+            AddObstacleInstances(obs->obj, obs->id, obs->detailed);
+        else
+            DrawObstacle(obs->obj, obs->id, obs->detailed);
+    }
+
+    if (instancing)
+        DrawObstacleInstances();
+}
+
+// Adds the obstacles of a chunk in view to the view obstacles, culling blocks of its grid cells
+// before the obstacles on them. Before the race starts the pod is high above the level, so
+// obstacles at any distance are added.
+static void AddChunkObstacles(const LevelChunk *chunk, Camera camera, const ViewFrustum *frustum, bool playing)
+{
+    const float margin = OBSTACLE_DRAW_RAD[OBSTACLE_LAMP];
+    const float render_sqr = renderDistance*renderDistance;
+    const float lod_sqr = lodDistance*lodDistance;
+    const float detail_sqr = playing? lod_sqr : render_sqr;
+
+    BoundingBox bounds = {
+        {chunk->origin_x - margin, 0, chunk->origin_z - margin},
+        {chunk->origin_x + chunk->size + margin, OBSTACLE_TOP, chunk->origin_z + chunk->size + margin},
+    };
+    if (!FrustumHasBox(frustum, bounds))
+        return;
+
+    // Cells of the chunk within render distance
+    int x0 = 0, x1 = chunk->grid_w - 1;
+    int z0 = 0, z1 = chunk->grid_w - 1;
+
+    if (playing)
+    {
+        float reach = renderDistance + margin;
+
+        x0 = maxi(x0, (int) floorf((camera.position.x - reach - chunk->origin_x)/GRID_CELL_SIZE));
+        x1 = mini(x1, (int) floorf((camera.position.x + reach - chunk->origin_x)/GRID_CELL_SIZE));
+        z0 = maxi(z0, (int) floorf((camera.position.z - reach - chunk->origin_z)/GRID_CELL_SIZE));
+        z1 = mini(z1, (int) floorf((camera.position.z + reach - chunk->origin_z)/GRID_CELL_SIZE));
+    }
+
+    for (int bz = z0; bz <= z1; bz += CULL_BLOCK_CELLS)
+    {
+        for (int bx = x0; bx <= x1; bx += CULL_BLOCK_CELLS)
+        {
+            int ex = mini(bx + CULL_BLOCK_CELLS - 1, x1);
+            int ez = mini(bz + CULL_BLOCK_CELLS - 1, z1);
+
+            BoundingBox block = {
+                {chunk->origin_x + bx*GRID_CELL_SIZE - margin, 0, chunk->origin_z + bz*GRID_CELL_SIZE - margin},
+                {chunk->origin_x + (ex + 1)*GRID_CELL_SIZE + margin, OBSTACLE_TOP, chunk->origin_z + (ez + 1)*GRID_CELL_SIZE + margin},
+            };
+            if (!FrustumHasBox(frustum, block))
+                continue;
+
+            for (int z = bz; z <= ez; ++z)
+            {
+                // Cells on the same row are contiguous
+                int start = chunk->grid_start[z*chunk->grid_w + bx];
+                int end = chunk->grid_start[z*chunk->grid_w + ex + 1];
+
+                for (int k = start; k < end; ++k)
+                {
+                    int i = chunk->grid_objs[k];
+                    Obstacle obj = chunk->objs[i];
+                    float distance_sqr = Vector3DistanceSqr(camera.position, obj.pos);
+
+                    if (playing && distance_sqr > render_sqr)
+                        continue;
+                    if (!FrustumHasSphere(frustum, (Vector3){obj.pos.x, 1, obj.pos.z}, OBSTACLE_DRAW_RAD[obj.type]))
+                        continue;
+
+                    AddViewObstacle(obj, i, distance_sqr <= detail_sqr);
+                }
+            }
+        }
+    }
+}
+
+// Scene seen from the given pod: background, obstacles, the other pods and the carrot
+static void DrawPodScene(int index, Camera camera, Rectangle rect)
+{
+    // What was batched before belongs to someone else, send it first
+    rlDrawRenderBatchActive();
+
+    double start = GetTime();
+    Player view = ViewPlayer(index);
+    bool split = viewsCount > 1;
+
+    // The background is scaled with the view, repeating around the horizon
     Texture2D background = textureBackground[currentLevel];
+    float scale = rect.height/SCREEN_H;
+    float background_w = background.width*scale;
 
-    int background_x = (int) roundf(-player.ang / (2 * PI) * background.width);
-    background_x = mod(background_x, background.width);
+    int background_x = (int) roundf(-view.ang / (2 * PI) * background_w);
+    background_x = mod(background_x, (int) background_w);
 
     if (currentLevel == LEVEL_LIGHTS)
-        ClearBackground(SCREEN_COLOR_LIT);
+        DrawRectangleRec(rect, SCREEN_COLOR_LIT);
 
-    DrawTexture(background, -background_x, 0, WHITE);
-    DrawTexture(background, -background_x + background.width, 0, WHITE);
+    for (int i = 0; i < 2; ++i)
+    {
+        Rectangle src = {0, 0, background.width, background.height};
+        Rectangle dst = {rect.x - background_x + i*background_w, rect.y, background_w, background.height*scale};
 
-    BeginMode3D(camera);
+        DrawTexturePro(background, src, dst, (Vector2){0, 0}, 0, WHITE);
+    }
+    gameplayStats.drawCalls += 2;
+
+    if (outlining)
+        BeginOutlinePass();
+
+    BeginViewMode3D(camera, rect);
+
+        ViewFrustum frustum = CameraFrustum(camera, rect.width/rect.height);
+        const LevelChunk *chunks[VIEW_CHUNKS];
+        int chunks_count = LevelChunksNear(level, camera.position, renderDistance, chunks, VIEW_CHUNKS);
+
+        bool playing = view.time_playing != 0;
+
+        viewObstaclesCount = 0;
+        for (int c = 0; c < chunks_count; ++c)
+            AddChunkObstacles(chunks[c], camera, &frustum, playing);
+
+        // Buildings and trees hide most of what is behind them
+        if (playing && (currentLevel == LEVEL_CITY || currentLevel == LEVEL_FOREST))
+            MarkVisibleObstacles(camera, rect);
+
+        DrawViewObstacles();
+
+        // Draw moving hazards, where they are at the clock of the pod
+        float clock = Lerp(prevRace.time_playing[index], race.time_playing[index], simAlpha);
+
+        LevelTrafficPositions(level, clock, trafficXs, trafficZs);
+
+        for (int i = 0; i < level->traffic_count; ++i)
+        {
+            Vector3 pos = {trafficXs[i], 0, trafficZs[i]};
+            float distance_sqr = Vector3DistanceSqr(camera.position, pos);
+
+            if (distance_sqr <= renderDistance*renderDistance && FrustumHasSphere(&frustum, pos, HAZARD_DRAW_RAD))
+                DrawHazard(pos.x, pos.z, level->traffic_dx[i], distance_sqr <= lodDistance*lodDistance);
+        }
+
+        // Draw ghost, unless it is on top of the pod
+        Vector3 ghost_pos;
+        float ghost_ang;
+
+        if (ghostLoaded && GhostPose(&ghost, framesCounter - 2 + simAlpha, &ghost_pos, &ghost_ang) &&
+                Vector3DistanceSqr(ghost_pos, view.pos) > 4*PLAYER_RAD*PLAYER_RAD &&
+                Vector3DistanceSqr(camera.position, ghost_pos) <= renderDistance*renderDistance)
+        {
+            DrawPodWires(ghost_pos, ghost_ang);
+        }
 
-        for (int i = 0; i < level->objs_count; ++i)
+        // Draw the other pods. On split screen there is no driver in front of the camera,
+        // so the own pod is drawn too.
+        for (int i = 0; i < race.players_count; ++i)
         {
-            float distance = Vector3Distance(camera.position, level->objs[i].pos);
+            Player other = ViewPlayer(i);
 
-            if (level->time_playing == 0)
+            if (i == index)
             {
-                DrawObstacle(level->objs[i], i, distance <= RENDER_DISTANCE);
+                if (split && !view.time_death)
+                    DrawPodWires(view.pos, view.ang);
+                continue;
             }
-            else
+
+            if (Vector3DistanceSqr(other.pos, view.pos) > 4*PLAYER_RAD*PLAYER_RAD &&
+                    Vector3DistanceSqr(camera.position, other.pos) <= renderDistance*renderDistance)
             {
-                if (distance <= RENDER_DISTANCE)
-                    DrawObstacle(level->objs[i], i, distance <= LOD_DISTANCE);
+                DrawPodWires(other.pos, other.ang);
             }
         }
 
         // Draw Carrot
-        DrawBorderedCube((Vector3){level->carrot_pos.x , 0.1 + CARROT_RAD, level->carrot_pos.z},
+        DrawBorderedCube((Vector3){view.carrot_pos.x , 0.1 + CARROT_RAD, view.carrot_pos.z},
                 CARROT_RAD, CARROT_RAD, CARROT_RAD, true);
 
-        if (currentLevel == LEVEL_ICE && level->time_playing > 0)
-            DrawSnow(camera, framesCounter);
+        if (currentLevel == LEVEL_ICE && view.time_playing > 0)
+            DrawSnow(camera, rect.height, framesCounter + simAlpha);
 
-    EndMode3D();
+    EndViewMode3D();
+
+    if (outlining)
+        EndOutlinePass(rect);
+
+    // Timed once the view is handed to the driver. The GPU may still be drawing it, waiting for it
+    // (glFinish) would stall every frame and GLES2 has no timer queries, so this is the CPU side
+    // of the view: culling, batching and the draw calls.
+    rlDrawRenderBatchActive();
+    gameplayStats.drawTime += GetTime() - start;
+}
+
+// Compact HUD of a split screen view: carrots, distance to the next one and where it is
+static void DrawSplitHud(int index, Camera camera, Rectangle rect)
+{
+    Player view = ViewPlayer(index);
+    char buffer[80];
+    int x = (int) rect.x;
+    int y = (int) rect.y;
+    int w = (int) rect.width;
+
+    sprintf(buffer, "%d/%d", view.n_carrots, TARGET_N_CARROTS);
+    DrawTextOutline(x + 1, y, buffer);
+
+    if (view.time_death)
+    {
+        DrawTextOutline(x + 1, y + rect.height - 9, "Crash");
+        return;
+    }
+
+    if (view.n_carrots == TARGET_N_CARROTS)
+    {
+        int seconds = (int) (view.time_finish/SIM_FPS);
+        sprintf(buffer, "%02d:%02d", seconds/60, seconds%60);
+        DrawTextOutline(x + 1, y + rect.height - 9, buffer);
+        return;
+    }
+
+    float carrot_angle = CarrotAngle(&view);
+    float carrot_distance = CarrotDistance(&view);
+
+    sprintf(buffer, "%dm", (int) roundf(carrot_distance));
+    DrawTextOutline(x + w - MeasureText(buffer, UI_FONT_SIZE) - 1, y, buffer);
+
+    bool carrot_in_view = -0.3*PI < carrot_angle && carrot_angle < 0.3*PI;
+
+    if (carrot_in_view && carrot_distance <= CARROT_IN_VIEW_DISTANCE)
+    {
+        Vector2 carrot_v = GetWorldToScreenEx(Vector3Add(view.carrot_pos, (Vector3){0, 0.1 + 2*CARROT_RAD, 0}), camera, w, rect.height);
+
+        DrawTile(textureDriver, 12, 12, 6 + (view.time_playing/2)%2, 0, x + carrot_v.x - 4, y + carrot_v.y - 7);
+    }
+    else if (carrot_angle > 0.1)
+    {
+        DrawTextOutline(x + 1, y + rect.height/2 - 4, "<");
+    }
+    else if (carrot_angle < -0.1)
+    {
+        DrawTextOutline(x + w - 5, y + rect.height/2 - 4, ">");
+    }
+}
+
+// Gameplay Screen Draw logic
+void DrawGameplayScreen(void)
+{
+    gameplayStats.drawCalls = 0;
+    gameplayStats.drawnObstacles = 0;
+    gameplayStats.drawTime = 0;
+    gameplayStats.renderDistance = renderDistance;
+    gameplayStats.lodDistance = lodDistance;
+
+    if (viewsCount > 1)
+    {
+        // Two views one over the other, or up to four in the corners
+        for (int i = 0; i < viewsCount; ++i)
+        {
+            Rectangle rect = (viewsCount == 2)?
+                    (Rectangle){0, i*SCREEN_H/2, SCREEN_W, SCREEN_H/2} :
+                    (Rectangle){(i%2)*SCREEN_W/2, (i/2)*SCREEN_H/2, SCREEN_W/2, SCREEN_H/2};
+            Player view = ViewPlayer(i);
+            Camera camera = PodCamera(&view);
+
+            BeginScissorMode(rect.x, rect.y, rect.width, rect.height);
+                DrawPodScene(i, camera, rect);
+                DrawSplitHud(i, camera, rect);
+            EndScissorMode();
+        }
+
+        DrawLine(0, SCREEN_H/2 - 1, SCREEN_W, SCREEN_H/2 - 1, SCREEN_COLOR_LIT);
+        if (viewsCount > 2)
+            DrawLine(SCREEN_W/2 - 1, 0, SCREEN_W/2 - 1, SCREEN_H, SCREEN_COLOR_LIT);
+        gameplayStats.drawCalls += 2;
+
+        return;
+    }
+
+    Player view = ViewPlayer(0);
+    Camera camera = PodCamera(&view);
 
-    if (!player.time_death)
+    DrawPodScene(0, camera, (Rectangle){0, 0, SCREEN_W, SCREEN_H});
+
+    if (waitingRival)
+    {
+        const char *text = "Waiting...";
+        DrawTextOutline(SCREEN_W/2 - MeasureText(text, UI_FONT_SIZE)/2, SCREEN_H/2 - 12, text);
+    }
+
+    if (!view.time_death)
     {
         // Draw player
-        DrawTile(textureDriver, 12, 12, 3, (int) roundf(player.turbo_l), 36 - 10, 34);
-        DrawTile(textureDriver, 12, 12, 4, (int) roundf(player.turbo_r), 36 + 10, 34);
-        if (level->carrot_grab_anim)
+        DrawTile(textureDriver, 12, 12, 3, (int) roundf(view.turbo_l), 36 - 10, 34);
+        DrawTile(textureDriver, 12, 12, 4, (int) roundf(view.turbo_r), 36 + 10, 34);
+        if (view.carrot_grab_anim)
         {
             DrawTile(textureDriver, 12, 12, 0, 3, 36, 34);
-            DrawTile(textureDriver, 12, 12, 5, 0, 42, 28 - level->carrot_grab_anim/8);
+            DrawTile(textureDriver, 12, 12, 5, 0, 42, 28 - view.carrot_grab_anim/8);
         }
         else
         {
-            DrawTile(textureDriver, 12, 12, (int) roundf(player.turbo_l), (int) roundf(player.turbo_r), 36, 34);
+            DrawTile(textureDriver, 12, 12, (int) roundf(view.turbo_l), (int) roundf(view.turbo_r), 36, 34);
         }
 
-        if (level->n_carrots < TARGET_N_CARROTS)
+        if (view.n_carrots < TARGET_N_CARROTS)
         {
             // Carrot seeker
-            float carrot_angle = CarrotAngle(level, &player);
-            float carrot_distance = CarrotDistance(level, &player);
+            float carrot_angle = CarrotAngle(&view);
+            float carrot_distance = CarrotDistance(&view);
 
             // Get carrot position in the screen
-            Vector2 carrot_v = GetWorldToScreenEx(Vector3Add(level->carrot_pos, (Vector3){0, 0.1 + 2*CARROT_RAD, 0}), camera, SCREEN_W, SCREEN_H);
+            Vector2 carrot_v = GetWorldToScreenEx(Vector3Add(view.carrot_pos, (Vector3){0, 0.1 + 2*CARROT_RAD, 0}), camera, SCREEN_W, SCREEN_H);
             // Transform into render texture position
             bool carrot_in_view = -0.3*PI < carrot_angle && carrot_angle < 0.3*PI;
 
             if (carrot_in_view && carrot_distance <= CARROT_IN_VIEW_DISTANCE)
             {
-                DrawTile(textureDriver, 12, 12, 6 + (level->time_playing/2)%2, 0, carrot_v.x - 4, carrot_v.y - 7);
+                DrawTile(textureDriver, 12, 12, 6 + (view.time_playing/2)%2, 0, carrot_v.x - 4, carrot_v.y - 7);
             }
             else
             {
@@ -659,17 +1737,17 @@ void DrawGameplayScreen(void)
             }
 
             char buffer[80];
-            if (level->carrot_grab_anim)
+            if (view.carrot_grab_anim)
             {
                 // Total carrots collected
-                sprintf(buffer, "%d/%d", level->n_carrots, TARGET_N_CARROTS);
+                sprintf(buffer, "%d/%d", view.n_carrots, TARGET_N_CARROTS);
                 int w = MeasureText(buffer, UI_FONT_SIZE);
                 DrawTextOutline(SCREEN_W/2 - w/2, 0, buffer);
             }
             else
             {
                 // Time counter
-                int seconds = level->time_playing/60;
+                int seconds = view.time_playing/60;
                 sprintf(buffer, "%02d:%02d", seconds/60, seconds%60);
                 DrawTextOutline(1, 0, buffer);
 
@@ -682,7 +1760,7 @@ void DrawGameplayScreen(void)
     }
     else
     {
-        int anim = player.time_death * 12 / PLAYER_DEATH_ANIMATION_TIME;
+        int anim = view.time_death * 12 / PLAYER_DEATH_ANIMATION_TIME;
 
         DrawTile(textureDriver, 12, 12, anim, 4, 36, 34);
         DrawTile(textureDriver, 12, 12, 3, 3, 36 - 10, 34);
@@ -696,8 +1774,21 @@ void UnloadGameplayScreen(void)
     UnloadTexture(textureDriver);
     for (int i = 0; i < LEVEL_COUNT; ++i)
         UnloadTexture(textureBackground[i]);
+    UnloadSnow();
+    UnloadOutlinePass();
+    UnloadObstacleInstancing();
+    MemFree(viewObstacles);
+    MemFree(occlusionOrder);
+    viewObstacles = NULL;
+    occlusionOrder = NULL;
+    viewObstaclesCapacity = 0;
+
+    if (netplayOn)
+        CloseNetplay(&netplay);
 
     UnloadLevel(level);
+    MemFree(trafficXs);
+    MemFree(trafficZs);
 
     UnloadSound(fxBreak);
     UnloadSound(fxGrab);
@@ -710,8 +1801,32 @@ int FinishGameplayScreen(void)
 {
     if (finishScreen)
     {
-        lastGameTime = level->time_playing/60;
+        // The winner is the pod that finished first, on split screen the others may still finish
+        int winner = -1;
+
+        for (int i = 0; i < viewsCount; ++i)
+        {
+            if (race.n_carrots[i] == TARGET_N_CARROTS &&
+                    (winner < 0 || race.time_finish[i] < race.time_finish[winner]))
+                winner = i;
+        }
+
+        lastGameTime = (winner >= 0)? race.time_finish[winner]/SIM_FPS : (float) race.time_playing[0]/SIM_FPS;
         lastGameComplete = (finishScreen == 2);
+        lastGameWinner = (viewsCount > 1)? winner : -1;
+        ReplayFlush(&replay);
     }
     return finishScreen;
 }
+
+// Saves the replay of the last race
+bool SaveGameplayReplay(const char *fileName)
+{
+    return SaveReplay(&replay, fileName);
+}
+
+// Saves the trajectory of the last race, to be shown as a ghost
+bool SaveGameplayGhost(const char *fileName)
+{
+    return SaveGhost(&ghostRun, fileName);
+}
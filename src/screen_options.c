@@ -79,6 +79,20 @@ void UpdateOptionsScreen(void)
     if (IsKeyPressed(KEY_UP) || IsGamepadButtonPressed(0, GAMEPAD_BUTTON_LEFT_FACE_UP))
         currentLevel = (currentLevel + LEVEL_COUNT - 1) % LEVEL_COUNT;
 
+    // Split screen players
+    if (IsKeyPressed(KEY_RIGHT) || IsGamepadButtonPressed(0, GAMEPAD_BUTTON_LEFT_FACE_RIGHT))
+        localPlayers = localPlayers % MAX_LOCAL_PLAYERS + 1;
+    if (IsKeyPressed(KEY_LEFT) || IsGamepadButtonPressed(0, GAMEPAD_BUTTON_LEFT_FACE_LEFT))
+        localPlayers = (localPlayers + MAX_LOCAL_PLAYERS - 2) % MAX_LOCAL_PLAYERS + 1;
+
+    // Endless world
+    if (IsKeyPressed(KEY_E) || IsGamepadButtonPressed(0, GAMEPAD_BUTTON_RIGHT_FACE_UP))
+        endlessMode = !endlessMode;
+
+    // Race against the record run
+    if (IsKeyPressed(KEY_G) || IsGamepadButtonPressed(0, GAMEPAD_BUTTON_RIGHT_FACE_LEFT))
+        ghostRace = !ghostRace;
+
     if (IsKeyPressed(KEY_ENTER) || IsKeyPressed(KEY_SPACE) || IsKeyPressed(KEY_Z) || IsGamepadButtonDown(0, GAMEPAD_BUTTON_RIGHT_FACE_DOWN))
         finishScreen = true;
 }
@@ -86,7 +100,16 @@ void UpdateOptionsScreen(void)
 // Options Screen Draw logic
 void DrawOptionsScreen(void)
 {
-    DrawText("- Level Select -", 0, -1, 8, SCREEN_COLOR_LIT);
+    if (localPlayers == 1 && endlessMode)
+        DrawText("- Endless -", 0, -1, 8, SCREEN_COLOR_LIT);
+    else if (localPlayers == 1 && ghostRace)
+        DrawText("- Race Ghost -", 0, -1, 8, SCREEN_COLOR_LIT);
+    else if (localPlayers == 1)
+        DrawText("- Level Select -", 0, -1, 8, SCREEN_COLOR_LIT);
+    else if (endlessMode)
+        DrawText(TextFormat("- %dP Endless -", localPlayers), 0, -1, 8, SCREEN_COLOR_LIT);
+    else
+        DrawText(TextFormat("- %d Players -", localPlayers), 0, -1, 8, SCREEN_COLOR_LIT);
     for (int i = 0; i < LEVEL_COUNT; ++i)
     {
         if (i == currentLevel)
@@ -99,7 +122,7 @@ void DrawOptionsScreen(void)
             DrawText(levelNames[i], 1, 10*i + 8, 8, SCREEN_COLOR_LIT);
         }
 
-        if (persistentData.time[i] != 0)
+        if (persistentData.time[i] != 0 && !endlessMode)
         {
             char buffer[200];
 
@@ -1,6 +1,8 @@
 #ifndef SCREENS_H
 #define SCREENS_H
 
+#include <stdint.h>
+
 //----------------------------------------------------------------------------------
 // Nokia screen details
 //----------------------------------------------------------------------------------
@@ -11,6 +13,8 @@
 #define SCREEN_COLOR_BG (Color){0x87, 0x91, 0x88, 0xff}
 #define SCREEN_COLOR_LIT (Color){0x1a, 0x19, 0x14, 0xff}
 
+#define MAX_LOCAL_PLAYERS 4     // Split screen views
+
 //----------------------------------------------------------------------------------
 // Types and Structures Definition
 //----------------------------------------------------------------------------------
@@ -29,6 +33,14 @@ typedef struct {
     int time[LEVEL_COUNT];
 } GamePersistentData;
 
+typedef struct {
+    int drawCalls;          // raylib draw calls issued by the last gameplay frame
+    int drawnObstacles;     // Obstacles drawn by the last gameplay frame
+    float drawTime;         // Seconds submitting the views of the last gameplay frame, without GPU time
+    float renderDistance;   // Distance obstacles were drawn to on the last gameplay frame
+    float lodDistance;      // Distance obstacles were drawn with detail to
+} GameplayStats;
+
 bool SaveGame(void);
 bool LoadGame(void);
 //----------------------------------------------------------------------------------
@@ -40,11 +52,22 @@ extern LevelArea currentLevel;
 extern Font font;
 extern Music music;
 extern Sound fxCoin;
-extern int lastGameTime;
+extern float lastGameTime;           // Seconds, with sub-frame precision
 extern bool lastGameComplete;
+extern int lastGameWinner;          // Player that won a split screen race, -1 if none or racing alone
 extern bool isMusicOn;
 extern bool triggerAxisDetected;
 extern int triggerLeftAxis, triggerRightAxis;
+extern uint64_t nextLevelSeed;      // Seed of the next gameplay level, 0 picks a random one
+extern bool benchmarkMode;          // Gameplay is driven by a script, for benchmark runs
+extern int netplayPort;             // UDP port to race against a local rival, 0 to race alone
+extern int netplayRivalPort;        // UDP port of the rival game
+extern int localPlayers;            // Players racing on split screen, each with its own gamepad
+extern bool endlessMode;            // Race on a streamed world with no borders, instead of a map
+extern bool ghostRace;              // Race the record run of the level, on its layout
+extern bool outlinePass;            // Draw the edges of the views with a post-process pass, not lines
+extern RenderTexture2D nokiaScreen; // Target the screens are drawn on, before scaling it to the window
+extern GameplayStats gameplayStats;
 
 #ifdef __cplusplus
 extern "C" {            // Prevents name mangling of functions
@@ -94,6 +117,8 @@ void UpdateGameplayScreen(void);
 void DrawGameplayScreen(void);
 void UnloadGameplayScreen(void);
 int FinishGameplayScreen(void);
+bool SaveGameplayReplay(const char *fileName);
+bool SaveGameplayGhost(const char *fileName);
 
 //----------------------------------------------------------------------------------
 // Ending Screen Functions Declaration
@@ -123,6 +148,16 @@ static inline float maxf(float a, float b)
     return a > b ? a : b;
 }
 
+static inline int mini(int a, int b)
+{
+    return a < b ? a : b;
+}
+
+static inline int maxi(int a, int b)
+{
+    return a > b ? a : b;
+}
+
 static inline bool IsAnyKeyPressed()
 {
     int key;
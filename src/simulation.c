@@ -0,0 +1,2283 @@
+/*******************************************************************************************
+*
+*   Nokia Pod Racer
+*   Race simulation: level generation, collisions and pod physics.
+*
+*   Copyright (c) 2023 Francisco Casas (@autopawn)
+*
+********************************************************************************************/
+
+#include "raylib.h"
+#include "raymath.h"
+#include "simulation.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__AVX2__)
+    #include <immintrin.h>
+#elif defined(__SSE2__)
+    #include <emmintrin.h>
+#endif
+
+//----------------------------------------------------------------------------------
+// Types and Structures Definition
+//----------------------------------------------------------------------------------
+
+// Grid cells from (x0, z0) to (x1, z1), both included
+typedef struct
+{
+    int x0, x1, z0, z1;
+} GridRect;
+
+#define CHUNK_CACHE_SLOTS 128       // Chunks loaded at once by an endless level, enough for 4 views
+#define CHUNK_TABLE_SIZE 256        // Power of two, at least twice the slots
+#define LEVEL_QUERY_CHUNKS 16       // Chunks touched by a single collision query
+#define TRAFFIC_SWEEP_FRAMES 4      // Frames of a long traffic sweep in which hazards move in a line
+
+// Bounded set of loaded chunks of an endless level. The arrays of every slot are allocated with
+// the level, so streaming the world doesn't allocate memory.
+struct ChunkCache
+{
+    LevelChunk slots[CHUNK_CACHE_SLOTS];
+    int slot_x[CHUNK_CACHE_SLOTS], slot_z[CHUNK_CACHE_SLOTS];
+    uint64_t last_use[CHUNK_CACHE_SLOTS];
+    int slots_used;
+    uint64_t clock;                 // Grows on every chunk use
+
+    // Open addressing table from chunk coordinates to slots, -1 on empty entries
+    int16_t table[CHUNK_TABLE_SIZE];
+};
+
+//----------------------------------------------------------------------------------
+// Global Variables Definition
+//----------------------------------------------------------------------------------
+unsigned int simAllocations = 0;
+
+//----------------------------------------------------------------------------------
+// Module Functions Definition
+//----------------------------------------------------------------------------------
+
+// Every allocation of the simulation goes through here, so they can be counted
+static void *SimAlloc(unsigned int size)
+{
+    simAllocations++;
+    return MemAlloc(size);
+}
+
+static float fremf(float a, float b)
+{
+    float r = fmodf(a, b);
+    return r < 0 ? r + b : r;
+}
+
+// SplitMix64 generator, gives the same sequence on every platform unlike rand()
+static uint32_t RandomNext(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return (uint32_t) ((z ^ (z >> 31)) >> 32);
+}
+
+// Random integer in [0, n)
+static int RandomInt(uint64_t *state, int n)
+{
+    return (int) (((uint64_t) RandomNext(state) * n) >> 32);
+}
+
+static bool ObstacleOverlaps(const Obstacle *obj, Vector3 point, float rad)
+{
+    float obj_rad = OBSTACLE_RAD[obj->type];
+
+    if (point.x + rad <= obj->pos.x - obj_rad)
+        return false;
+    if (point.x - rad >= obj->pos.x + obj_rad)
+        return false;
+    if (point.z + rad <= obj->pos.z - obj_rad)
+        return false;
+    if (point.z - rad >= obj->pos.z + obj_rad)
+        return false;
+
+    return true;
+}
+
+// Integer division rounded down, also for negative numbers
+static int FloorDiv(int a, int b)
+{
+    return (a >= 0)? a/b : -1 - (-1 - a)/b;
+}
+
+// Grid cell of a world coordinate, on any chunk
+static int WorldCell(float coord)
+{
+    return (int) floorf(coord/GRID_CELL_SIZE);
+}
+
+static int WorldCellFixed(Fixed coord)
+{
+    return FloorDiv(coord, GRID_CELL_SIZE*FIXED_ONE);
+}
+
+// Grid cell of the map, coordinates outside it are clamped to its border
+static int LevelGridCell(const Level *level, float coord)
+{
+    int cell = WorldCell(coord);
+
+    if (cell < 0)
+        return 0;
+    if (cell >= level->map.grid_w)
+        return level->map.grid_w - 1;
+    return cell;
+}
+
+// Cells of the chunk in a rect of world cells. Cells outside the chunk are clamped to its border,
+// where the obstacles outside it are stored.
+static inline GridRect ChunkRect(const LevelChunk *chunk, GridRect cells)
+{
+    int x = chunk->origin_x/GRID_CELL_SIZE;
+    int z = chunk->origin_z/GRID_CELL_SIZE;
+    int last = chunk->grid_w - 1;
+
+    return (GridRect){
+        mini(maxi(cells.x0 - x, 0), last), mini(maxi(cells.x1 - x, 0), last),
+        mini(maxi(cells.z0 - z, 0), last), mini(maxi(cells.z1 - z, 0), last),
+    };
+}
+
+static int16_t Quantize(float coord)
+{
+    return (int16_t) lroundf(coord * OBJS_QUANT);
+}
+
+// Distance from the start of its lane of the hazard i at the given clock, in 1/OBJS_QUANT units
+static int TrafficOffset(const Level *level, int i, int clock)
+{
+    int len = level->traffic_len[i];
+    int trip = (clock*level->traffic_spd[i] + level->traffic_phase[i]) % (2*len);
+
+    return len - abs(trip - len);
+}
+
+// Whether the lane of the hazard i crosses the box from (x0, z0) to (x1, z1), in 1/OBJS_QUANT
+// units. Most hazards near a pod are rejected by this, without finding where they are.
+static bool TrafficLaneTouches(const Level *level, int i, int x0, int x1, int z0, int z1)
+{
+    int lane_x = level->traffic_qx[i];
+    int lane_z = level->traffic_qz[i];
+
+    return lane_x <= x1 && lane_x + level->traffic_dx[i]*level->traffic_len[i] >= x0 &&
+            lane_z <= z1 && lane_z + level->traffic_dz[i]*level->traffic_len[i] >= z0;
+}
+
+// Coarse traffic grid cells covering the box from (x0, z0) to (x1, z1), in 1/OBJS_QUANT units
+static GridRect TrafficCells(const Level *level, int x0, int x1, int z0, int z1)
+{
+    const int CELL = TRAFFIC_CELL_SIZE*OBJS_QUANT;
+    int last = level->traffic_grid_w - 1;
+
+    return (GridRect){
+        mini(maxi(x0, 0)/CELL, last), mini(maxi(x1, 0)/CELL, last),
+        mini(maxi(z0, 0)/CELL, last), mini(maxi(z1, 0)/CELL, last),
+    };
+}
+
+// Whether any of the n obstacles at (xs[i], zs[i]) is closer than qrad to (qx, qz) on both axes
+static bool ObstaclesOverlapAny(const int16_t *xs, const int16_t *zs, int n, int16_t qx, int16_t qz, int16_t qrad)
+{
+    int i = 0;
+
+#if defined(__AVX2__)
+    __m256i px16 = _mm256_set1_epi16(qx);
+    __m256i pz16 = _mm256_set1_epi16(qz);
+    __m256i rad16 = _mm256_set1_epi16(qrad);
+
+    for (; i + 16 <= n; i += 16)
+    {
+        __m256i dx = _mm256_abs_epi16(_mm256_sub_epi16(_mm256_loadu_si256((const __m256i *) (xs + i)), px16));
+        __m256i dz = _mm256_abs_epi16(_mm256_sub_epi16(_mm256_loadu_si256((const __m256i *) (zs + i)), pz16));
+        __m256i hit = _mm256_and_si256(_mm256_cmpgt_epi16(rad16, dx), _mm256_cmpgt_epi16(rad16, dz));
+
+        if (!_mm256_testz_si256(hit, hit))
+            return true;
+    }
+#endif
+#if defined(__SSE2__)
+    __m128i zero8 = _mm_setzero_si128();
+    __m128i px8 = _mm_set1_epi16(qx);
+    __m128i pz8 = _mm_set1_epi16(qz);
+    __m128i rad8 = _mm_set1_epi16(qrad);
+
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i dx = _mm_sub_epi16(_mm_loadu_si128((const __m128i *) (xs + i)), px8);
+        __m128i dz = _mm_sub_epi16(_mm_loadu_si128((const __m128i *) (zs + i)), pz8);
+        dx = _mm_max_epi16(dx, _mm_sub_epi16(zero8, dx));
+        dz = _mm_max_epi16(dz, _mm_sub_epi16(zero8, dz));
+        __m128i hit = _mm_and_si128(_mm_cmpgt_epi16(rad8, dx), _mm_cmpgt_epi16(rad8, dz));
+
+        if (_mm_movemask_epi8(hit))
+            return true;
+    }
+#endif
+
+    for (; i < n; ++i)
+    {
+        if (abs(xs[i] - qx) < qrad && abs(zs[i] - qz) < qrad)
+            return true;
+    }
+    return false;
+}
+
+// Cell of the chunk where an obstacle at coord is stored, clamped to its border
+static int ChunkCell(const LevelChunk *chunk, float coord, int origin)
+{
+    return mini(maxi(WorldCell(coord - origin), 0), chunk->grid_w - 1);
+}
+
+// Allocates the arrays of count chunks, with room for capacity obstacles each. Every array is a
+// single block, owned by the first chunk.
+static void ChunkAlloc(LevelChunk *chunks, int count, int grid_w, int capacity)
+{
+    int n_cells = grid_w * grid_w;
+
+    Obstacle *objs = SimAlloc(sizeof(*objs) * count * (capacity + 1));
+    int *grid_start = SimAlloc(sizeof(*grid_start) * count * (n_cells + 1));
+    int *grid_objs = SimAlloc(sizeof(*grid_objs) * count * (capacity + 1));
+    int16_t *objs_qx = SimAlloc(sizeof(*objs_qx) * count * (capacity + 1));
+    int16_t *objs_qz = SimAlloc(sizeof(*objs_qz) * count * (capacity + 1));
+    assert(objs && grid_start && grid_objs && objs_qx && objs_qz);
+
+    for (int i = 0; i < count; ++i)
+    {
+        chunks[i].grid_w = grid_w;
+        chunks[i].objs = objs + i*(capacity + 1);
+        chunks[i].grid_start = grid_start + i*(n_cells + 1);
+        chunks[i].grid_objs = grid_objs + i*(capacity + 1);
+        chunks[i].objs_qx = objs_qx + i*(capacity + 1);
+        chunks[i].objs_qz = objs_qz + i*(capacity + 1);
+    }
+}
+
+static void ChunkBuildGrid(LevelChunk *chunk)
+{
+    int n_cells = chunk->grid_w * chunk->grid_w;
+
+    memset(chunk->grid_start, 0, sizeof(*chunk->grid_start) * (n_cells + 1));
+
+    // Count the obstacles on each cell, then turn the counts into start offsets
+    for (int i = 0; i < chunk->objs_count; ++i)
+    {
+        const Obstacle *obj = &chunk->objs[i];
+        int cell = ChunkCell(chunk, obj->pos.z, chunk->origin_z) * chunk->grid_w + ChunkCell(chunk, obj->pos.x, chunk->origin_x);
+
+        chunk->grid_start[cell + 1]++;
+    }
+    for (int c = 0; c < n_cells; ++c)
+        chunk->grid_start[c + 1] += chunk->grid_start[c];
+
+    // Fill the cells, this shifts every start offset to the start of the next cell
+    for (int i = 0; i < chunk->objs_count; ++i)
+    {
+        const Obstacle *obj = &chunk->objs[i];
+        int cell = ChunkCell(chunk, obj->pos.z, chunk->origin_z) * chunk->grid_w + ChunkCell(chunk, obj->pos.x, chunk->origin_x);
+        int k = chunk->grid_start[cell]++;
+
+        chunk->grid_objs[k] = i;
+        chunk->objs_qx[k] = Quantize(obj->pos.x - chunk->origin_x);
+        chunk->objs_qz[k] = Quantize(obj->pos.z - chunk->origin_z);
+    }
+    for (int c = n_cells; c > 0; --c)
+        chunk->grid_start[c] = chunk->grid_start[c - 1];
+    chunk->grid_start[0] = 0;
+}
+
+static ObstacleType LevelObstacleType(LevelArea area)
+{
+    if (area == LEVEL_FOREST)
+        return OBSTACLE_TREE;
+    if (area == LEVEL_LIGHTS)
+        return OBSTACLE_LAMP;
+    if (area == LEVEL_ICE)
+        return OBSTACLE_IGLOO;
+    return OBSTACLE_BUILDING;
+}
+
+// Random obstacle at integer coordinates of the square of the given side from (x0, z0), trees
+// get some jitter
+static Obstacle RandomObstacle(ObstacleType type, int x0, int z0, int side, uint64_t *rng)
+{
+    Obstacle obs = {0};
+
+    obs.type = type;
+    obs.pos.x = x0 + RandomInt(rng, side);
+    obs.pos.y = 0;
+    obs.pos.z = z0 + RandomInt(rng, side);
+
+    if (obs.type == OBSTACLE_TREE)
+    {
+        obs.pos.x += (RandomInt(rng, 11) - 5)/7.0;
+        obs.pos.y += (RandomInt(rng, 11) - 5)/7.0;
+    }
+    return obs;
+}
+
+// Seed of the chunk (cx, cz) of an endless level, so it can be generated alone and in any order
+static uint64_t ChunkSeed(const Level *level, int cx, int cz)
+{
+    uint64_t state = level->seed ^ ((uint64_t) (uint32_t) cz << 32 | (uint32_t) cx);
+    uint64_t high = RandomNext(&state);
+
+    return high << 32 | RandomNext(&state);
+}
+
+// Cell of the chunk kept free for carrots, with its 3x3 neighbour cells. It is the first thing
+// drawn from the chunk seed, so it is known without generating the chunk.
+static Vector3 ChunkClearing(int cx, int cz, uint64_t *rng)
+{
+    const int CHUNK_CELLS = CHUNK_SIZE/GRID_CELL_SIZE;
+
+    // Away from the chunk sides, which obstacles of the neighbour chunks never cross
+    int x = 1 + RandomInt(rng, CHUNK_CELLS - 2);
+    int z = 1 + RandomInt(rng, CHUNK_CELLS - 2);
+
+    return (Vector3){cx*CHUNK_SIZE + (x + 0.5f)*GRID_CELL_SIZE, 0, cz*CHUNK_SIZE + (z + 0.5f)*GRID_CELL_SIZE};
+}
+
+// Generates the chunk (cx, cz) of an endless level on the arrays of a cache slot
+static void GenerateChunk(const Level *level, LevelChunk *chunk, int cx, int cz)
+{
+    ObstacleType type = LevelObstacleType(level->area);
+    const float spacing_rad = 0.8 * OBSTACLE_RAD[type];
+    const float clearing_ext = (CARROT_SPAWN_CLEARANCE - 0.5f)*GRID_CELL_SIZE + OBSTACLE_RAD[type];
+
+    uint64_t rng = ChunkSeed(level, cx, cz);
+    Vector3 clearing = ChunkClearing(cx, cz, &rng);
+
+    chunk->origin_x = cx*CHUNK_SIZE;
+    chunk->origin_z = cz*CHUNK_SIZE;
+    chunk->size = CHUNK_SIZE;
+    chunk->objs_count = 0;
+
+    // Dart throwing like LevelPlaceObstacles, with few obstacles so each candidate is checked
+    // against all of them. Obstacles keep a unit away from the chunk sides, so they never overlap
+    // the ones of the neighbour chunks, and a chunk that is too full stays with fewer.
+    for (int attempt = 0; attempt < 16*level->chunk_objs && chunk->objs_count < level->chunk_objs; ++attempt)
+    {
+        Obstacle obs = RandomObstacle(type, chunk->origin_x + 1, chunk->origin_z + 1, CHUNK_SIZE - 2, &rng);
+
+        if (absf(obs.pos.x - clearing.x) <= clearing_ext && absf(obs.pos.z - clearing.z) <= clearing_ext)
+            continue;
+
+        bool free = true;
+
+        for (int k = 0; k < chunk->objs_count && free; ++k)
+            free = !ObstacleOverlaps(&chunk->objs[k], obs.pos, spacing_rad);
+
+        if (free)
+            chunk->objs[chunk->objs_count++] = obs;
+    }
+
+    ChunkBuildGrid(chunk);
+}
+
+static int ChunkHash(int cx, int cz)
+{
+    uint32_t h = (uint32_t) cx*0x9e3779b1u ^ (uint32_t) cz*0x85ebca6bu;
+
+    return (h ^ (h >> 16)) & (CHUNK_TABLE_SIZE - 1);
+}
+
+// Entry of the cache table that holds the chunk (cx, cz), or the empty one where it would go
+static int ChunkTableEntry(const ChunkCache *cache, int cx, int cz)
+{
+    int e = ChunkHash(cx, cz);
+
+    while (cache->table[e] != -1)
+    {
+        int slot = cache->table[e];
+
+        if (cache->slot_x[slot] == cx && cache->slot_z[slot] == cz)
+            break;
+        e = (e + 1) & (CHUNK_TABLE_SIZE - 1);
+    }
+    return e;
+}
+
+// Empties an entry of the cache table, moving back the entries after it that would be lost
+static void ChunkTableRemove(ChunkCache *cache, int e)
+{
+    const int MASK = CHUNK_TABLE_SIZE - 1;
+
+    for (int next = (e + 1) & MASK; cache->table[next] != -1; next = (next + 1) & MASK)
+    {
+        int slot = cache->table[next];
+        int home = ChunkHash(cache->slot_x[slot], cache->slot_z[slot]);
+
+        // The entry can fill the hole unless its home is after the hole
+        if (((next - home) & MASK) >= ((next - e) & MASK))
+        {
+            cache->table[e] = slot;
+            e = next;
+        }
+    }
+    cache->table[e] = -1;
+}
+
+// Chunk (cx, cz) of an endless level if it is loaded, NULL otherwise
+static const LevelChunk *LevelChunkLoaded(const Level *level, int cx, int cz)
+{
+    const ChunkCache *cache = level->chunks;
+    int slot = cache->table[ChunkTableEntry(cache, cx, cz)];
+
+    return (slot == -1)? NULL : &cache->slots[slot];
+}
+
+// Chunk (cx, cz) of an endless level, generated now on the slot of the least recently used one
+// if it isn't loaded. A chunk is the same whenever it is generated, so this only costs time.
+static const LevelChunk *LevelChunkAt(Level *level, int cx, int cz)
+{
+    ChunkCache *cache = level->chunks;
+    int e = ChunkTableEntry(cache, cx, cz);
+    int slot = cache->table[e];
+
+    if (slot == -1)
+    {
+        if (cache->slots_used < CHUNK_CACHE_SLOTS)
+        {
+            slot = cache->slots_used++;
+        }
+        else
+        {
+            slot = 0;
+            for (int s = 1; s < CHUNK_CACHE_SLOTS; ++s)
+            {
+                if (cache->last_use[s] < cache->last_use[slot])
+                    slot = s;
+            }
+
+            // Removing the old chunk can move the entry of the new one
+            ChunkTableRemove(cache, ChunkTableEntry(cache, cache->slot_x[slot], cache->slot_z[slot]));
+            e = ChunkTableEntry(cache, cx, cz);
+        }
+
+        cache->slot_x[slot] = cx;
+        cache->slot_z[slot] = cz;
+        cache->table[e] = slot;
+        GenerateChunk(level, &cache->slots[slot], cx, cz);
+    }
+
+    cache->last_use[slot] = ++cache->clock;
+    return &cache->slots[slot];
+}
+
+// Chunks of an endless level with the obstacles of a rect of world cells
+static int LevelChunksInEndless(Level *level, GridRect cells, const LevelChunk **chunks)
+{
+    const int CHUNK_CELLS = CHUNK_SIZE/GRID_CELL_SIZE;
+
+    int count = 0;
+
+    for (int cz = FloorDiv(cells.z0, CHUNK_CELLS); cz <= FloorDiv(cells.z1, CHUNK_CELLS); ++cz)
+    {
+        for (int cx = FloorDiv(cells.x0, CHUNK_CELLS); cx <= FloorDiv(cells.x1, CHUNK_CELLS); ++cx)
+        {
+            // Queries are about the size of a pod move, far from covering this many chunks
+            assert(count < LEVEL_QUERY_CHUNKS);
+            chunks[count++] = LevelChunkAt(level, cx, cz);
+        }
+    }
+    return count;
+}
+
+// Chunks with the obstacles of a rect of world cells, the map alone on levels of fixed size
+static inline int LevelChunksIn(Level *level, GridRect cells, const LevelChunk **chunks)
+{
+    if (level->endless)
+        return LevelChunksInEndless(level, cells, chunks);
+
+    chunks[0] = &level->map;
+    return 1;
+}
+
+// Whether an obstacle of the chunk, on a rect of world cells, is closer than qrad to (qx, qz) on
+// both axes. The point is quantized from the origin of the chunk.
+static inline bool ChunkOverlapsAny(const LevelChunk *chunk, GridRect cells, int16_t qx, int16_t qz, int16_t qrad)
+{
+    GridRect rect = ChunkRect(chunk, cells);
+
+    for (int z = rect.z0; z <= rect.z1; ++z)
+    {
+        // Cells on the same row are contiguous
+        int start = chunk->grid_start[z*chunk->grid_w + rect.x0];
+        int end = chunk->grid_start[z*chunk->grid_w + rect.x1 + 1];
+
+        if (ObstaclesOverlapAny(chunk->objs_qx + start, chunk->objs_qz + start, end - start, qx, qz, qrad))
+            return true;
+    }
+    return false;
+}
+
+// Whether a box of radius rad at point touches an obstacle, or a moving hazard where it is at the
+// given race clock
+bool LevelCheckCollision(Level *level, Vector3 point, float rad, int clock)
+{
+    float reach = rad + level->objs_rad;
+    int16_t qrad = Quantize(reach);
+    GridRect cells = {WorldCell(point.x - reach), WorldCell(point.x + reach), WorldCell(point.z - reach), WorldCell(point.z + reach)};
+
+    // Points far outside a chunk are clamped so the quantized distances can't overflow
+    float margin = reach + GRID_CELL_SIZE;
+
+    if (level->endless)
+    {
+        const LevelChunk *chunks[LEVEL_QUERY_CHUNKS];
+        int chunks_count = LevelChunksIn(level, cells, chunks);
+
+        for (int c = 0; c < chunks_count; ++c)
+        {
+            int16_t qx = Quantize(Clamp(point.x - chunks[c]->origin_x, -margin, CHUNK_SIZE + margin));
+            int16_t qz = Quantize(Clamp(point.z - chunks[c]->origin_z, -margin, CHUNK_SIZE + margin));
+
+            if (ChunkOverlapsAny(chunks[c], cells, qx, qz, qrad))
+                return true;
+        }
+
+        // Endless levels have no moving hazards
+        return false;
+    }
+
+    int16_t qx = Quantize(Clamp(point.x, -margin, level->map_size + margin));
+    int16_t qz = Quantize(Clamp(point.z, -margin, level->map_size + margin));
+
+    if (ChunkOverlapsAny(&level->map, cells, qx, qz, qrad))
+        return true;
+
+    if (level->traffic_count == 0)
+        return false;
+
+    int traffic_qrad = Quantize(rad + level->traffic_rad);
+    GridRect traffic_cells = TrafficCells(level, qx - traffic_qrad, qx + traffic_qrad, qz - traffic_qrad, qz + traffic_qrad);
+
+    for (int z = traffic_cells.z0; z <= traffic_cells.z1; ++z)
+    {
+        for (int x = traffic_cells.x0; x <= traffic_cells.x1; ++x)
+        {
+            int c = z*level->traffic_grid_w + x;
+
+            for (int k = level->traffic_start[c]; k < level->traffic_start[c + 1]; ++k)
+            {
+                int i = level->traffic_ids[k];
+
+                if (!TrafficLaneTouches(level, i, qx - traffic_qrad, qx + traffic_qrad, qz - traffic_qrad, qz + traffic_qrad))
+                    continue;
+
+                int offset = TrafficOffset(level, i, clock);
+
+                if (abs(level->traffic_qx[i] + level->traffic_dx[i]*offset - qx) < traffic_qrad &&
+                        abs(level->traffic_qz[i] + level->traffic_dz[i]*offset - qz) < traffic_qrad)
+                    return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Times in which a point moving from start by delta is within ext from the center, on one axis
+static void SweepAxis(float start, float delta, float ext, float *t_in, float *t_out)
+{
+    if (delta == 0)
+    {
+        bool inside = absf(start) < ext;
+
+        *t_in = inside ? -INFINITY : INFINITY;
+        *t_out = inside ? INFINITY : -INFINITY;
+        return;
+    }
+
+    float t0 = (-ext - start)/delta;
+    float t1 = (ext - start)/delta;
+
+    *t_in = t0 < t1 ? t0 : t1;
+    *t_out = t0 < t1 ? t1 : t0;
+}
+
+// Whether the box that enters at t_in and leaves at t_out blocks the move, which happens if it is
+// entered during the move or if the move starts and ends inside it.
+// Starting inside and leaving it is allowed, so a pod is never stuck.
+static bool SweepBlocks(float t_in, float t_out)
+{
+    if (t_in >= t_out)
+        return false;
+    if (t_in < 0)
+        return t_out > 1;
+    return t_in < 1;
+}
+
+// Adds the obstacle at (obj_x, obj_z) to the sweep of a box of radius reach from point along
+// delta, testing the whole move and the moves along each axis at once
+static void SweepObstacle(SweepResult *result, Vector3 point, Vector3 delta, float reach, float obj_x, float obj_z)
+{
+    float rel_x = point.x - obj_x;
+    float rel_z = point.z - obj_z;
+
+    // Skip obstacles that the swept box can't reach
+    if (absf(rel_x) >= reach + absf(delta.x) || absf(rel_z) >= reach + absf(delta.z))
+        return;
+
+    float tx_in, tx_out, tz_in, tz_out;
+    float sx_in, sx_out, sz_in, sz_out;
+
+    SweepAxis(rel_x, delta.x, reach, &tx_in, &tx_out);
+    SweepAxis(rel_z, delta.z, reach, &tz_in, &tz_out);
+
+    float t_in = fmaxf(tx_in, tz_in);
+    float t_out = fminf(tx_out, tz_out);
+
+    if (SweepBlocks(t_in, t_out))
+    {
+        result->hit = true;
+        result->toi = fminf(result->toi, fmaxf(t_in, 0));
+    }
+
+    // Moves along a single axis
+    SweepAxis(rel_x, 0, reach, &sx_in, &sx_out);
+    SweepAxis(rel_z, 0, reach, &sz_in, &sz_out);
+
+    if (SweepBlocks(fmaxf(tx_in, sz_in), fminf(tx_out, sz_out)))
+        result->hit_x = true;
+    if (SweepBlocks(fmaxf(sx_in, tz_in), fminf(sx_out, tz_out)))
+        result->hit_z = true;
+}
+
+// Adds the obstacles of the chunk on a rect of world cells to the sweep of a box of radius reach
+static inline void ChunkSweepCollision(const LevelChunk *chunk, GridRect cells, SweepResult *result, Vector3 point, Vector3 delta, float reach)
+{
+    GridRect rect = ChunkRect(chunk, cells);
+
+    // The point is taken from the origin of the chunk, like its obstacles
+    point.x -= chunk->origin_x;
+    point.z -= chunk->origin_z;
+
+    for (int z = rect.z0; z <= rect.z1; ++z)
+    {
+        int start = chunk->grid_start[z*chunk->grid_w + rect.x0];
+        int end = chunk->grid_start[z*chunk->grid_w + rect.x1 + 1];
+
+        for (int k = start; k < end; ++k)
+            SweepObstacle(result, point, delta, reach, (float) chunk->objs_qx[k]/OBJS_QUANT, (float) chunk->objs_qz[k]/OBJS_QUANT);
+    }
+}
+
+// Sweeps a box of radius rad from point along delta (only x and z are considered).
+// Does a single pass over the nearby obstacles. Unlike testing the end position, thin obstacles
+// can't be skipped by fast moves.
+SweepResult LevelSweepCollision(Level *level, Vector3 point, Vector3 delta, float rad)
+{
+    SweepResult result = {1, false, false, false, false};
+
+    float reach = rad + level->objs_rad;
+
+    GridRect cells = {
+        WorldCell(fminf(point.x, point.x + delta.x) - reach), WorldCell(fmaxf(point.x, point.x + delta.x) + reach),
+        WorldCell(fminf(point.z, point.z + delta.z) - reach), WorldCell(fmaxf(point.z, point.z + delta.z) + reach),
+    };
+    const LevelChunk *chunks[LEVEL_QUERY_CHUNKS];
+    int chunks_count = LevelChunksIn(level, cells, chunks);
+
+    for (int c = 0; c < chunks_count; ++c)
+        ChunkSweepCollision(chunks[c], cells, &result, point, delta, reach);
+
+    return result;
+}
+
+// Sweeps a box of radius rad from point along delta against the moving hazards, taking the given
+// frames from the race clock to do the move. The move is split in steps of a few frames in which
+// each hazard is swept as moving in a line, so the ones that turn around are followed.
+SweepResult LevelSweepTraffic(const Level *level, Vector3 point, Vector3 delta, float rad, int clock, int frames)
+{
+    SweepResult result = {1, false, false, false, false};
+
+    if (level->traffic_count == 0)
+        return result;
+
+    float reach = rad + level->traffic_rad;
+    int margin = (int) (reach*OBJS_QUANT) + 2;
+    int x0 = (int) (fminf(point.x, point.x + delta.x)*OBJS_QUANT) - margin;
+    int x1 = (int) (fmaxf(point.x, point.x + delta.x)*OBJS_QUANT) + margin;
+    int z0 = (int) (fminf(point.z, point.z + delta.z)*OBJS_QUANT) - margin;
+    int z1 = (int) (fmaxf(point.z, point.z + delta.z)*OBJS_QUANT) + margin;
+
+    GridRect cells = TrafficCells(level, x0, x1, z0, z1);
+
+    frames = maxi(frames, 1);
+    int steps = (frames + TRAFFIC_SWEEP_FRAMES - 1)/TRAFFIC_SWEEP_FRAMES;
+
+    for (int z = cells.z0; z <= cells.z1; ++z)
+    {
+        for (int x = cells.x0; x <= cells.x1; ++x)
+        {
+            int c = z*level->traffic_grid_w + x;
+
+            for (int k = level->traffic_start[c]; k < level->traffic_start[c + 1]; ++k)
+            {
+                int h = level->traffic_ids[k];
+
+                if (!TrafficLaneTouches(level, h, x0, x1, z0, z1))
+                    continue;
+
+                for (int s = 0; s < steps; ++s)
+                {
+                    int t0 = s*frames/steps;
+                    int t1 = (s + 1)*frames/steps;
+
+                    // The clock stays still before the pod lands
+                    int offset = TrafficOffset(level, h, clock? clock + t0 : 0);
+                    int move = TrafficOffset(level, h, clock? clock + t1 : 0) - offset;
+
+                    float f0 = (float) t0/frames;
+                    float f = (float) (t1 - t0)/frames;
+                    Vector3 start = {point.x + f0*delta.x, 0, point.z + f0*delta.z};
+                    Vector3 step = {
+                        f*delta.x - (float) (level->traffic_dx[h]*move)/OBJS_QUANT, 0,
+                        f*delta.z - (float) (level->traffic_dz[h]*move)/OBJS_QUANT,
+                    };
+                    SweepResult part = {1, false, false, false, false};
+
+                    SweepObstacle(&part, start, step, reach,
+                            (float) (level->traffic_qx[h] + level->traffic_dx[h]*offset)/OBJS_QUANT,
+                            (float) (level->traffic_qz[h] + level->traffic_dz[h]*offset)/OBJS_QUANT);
+
+                    if (part.hit)
+                    {
+                        result.hit = true;
+                        result.hit_traffic = true;
+                        result.toi = fminf(result.toi, f0 + part.toi*f);
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    return result;
+}
+
+// SweepAxis in fixed point, with times in fixed point too
+static void SweepAxisFixed(Fixed start, Fixed delta, Fixed ext, int64_t *t_in, int64_t *t_out)
+{
+    if (delta == 0)
+    {
+        bool inside = FixedAbs(start) < ext;
+
+        *t_in = inside ? INT64_MIN : INT64_MAX;
+        *t_out = inside ? INT64_MAX : INT64_MIN;
+        return;
+    }
+
+    int64_t t0 = ((int64_t) -ext - start)*FIXED_ONE/delta;
+    int64_t t1 = ((int64_t) ext - start)*FIXED_ONE/delta;
+
+    *t_in = t0 < t1 ? t0 : t1;
+    *t_out = t0 < t1 ? t1 : t0;
+}
+
+static bool SweepBlocksFixed(int64_t t_in, int64_t t_out)
+{
+    if (t_in >= t_out)
+        return false;
+    if (t_in < 0)
+        return t_out > FIXED_ONE;
+    return t_in < FIXED_ONE;
+}
+
+static int64_t Min64(int64_t a, int64_t b)
+{
+    return a < b ? a : b;
+}
+
+static int64_t Max64(int64_t a, int64_t b)
+{
+    return a > b ? a : b;
+}
+
+// SweepObstacle in fixed point, the time of impact is kept apart in toi
+static void SweepObstacleFixed(SweepResult *result, int64_t *toi, FixedVector3 point, FixedVector3 delta, Fixed reach,
+        Fixed obj_x, Fixed obj_z)
+{
+    Fixed rel_x = point.x - obj_x;
+    Fixed rel_z = point.z - obj_z;
+
+    if (FixedAbs(rel_x) >= reach + FixedAbs(delta.x) || FixedAbs(rel_z) >= reach + FixedAbs(delta.z))
+        return;
+
+    int64_t tx_in, tx_out, tz_in, tz_out;
+    int64_t sx_in, sx_out, sz_in, sz_out;
+
+    SweepAxisFixed(rel_x, delta.x, reach, &tx_in, &tx_out);
+    SweepAxisFixed(rel_z, delta.z, reach, &tz_in, &tz_out);
+
+    int64_t t_in = Max64(tx_in, tz_in);
+
+    if (SweepBlocksFixed(t_in, Min64(tx_out, tz_out)))
+    {
+        result->hit = true;
+        *toi = Min64(*toi, Max64(t_in, 0));
+    }
+
+    SweepAxisFixed(rel_x, 0, reach, &sx_in, &sx_out);
+    SweepAxisFixed(rel_z, 0, reach, &sz_in, &sz_out);
+
+    if (SweepBlocksFixed(Max64(tx_in, sz_in), Min64(tx_out, sz_out)))
+        result->hit_x = true;
+    if (SweepBlocksFixed(Max64(sx_in, tz_in), Min64(sx_out, tz_out)))
+        result->hit_z = true;
+}
+
+// World grid cells that the move of the pod i during this frame can touch, for boxes of the given
+// reach. Fixed-point positions go up to 32768 units from the origin, pods on endless levels are
+// kept within ENDLESS_WORLD_LIMIT of it (see PodUpdateMoveFixed).
+static GridRect PodSweepCells(const Level *level, const RaceState *race, int i, float reach, Fixed fixed_reach)
+{
+    if (level->physics_mode == PHYSICS_FIXED)
+    {
+        Fixed pos_x = race->fx_pos_x[i], spd_x = race->fx_spd_x[i];
+        Fixed pos_z = race->fx_pos_z[i], spd_z = race->fx_spd_z[i];
+
+        return (GridRect){
+            WorldCellFixed((spd_x < 0 ? pos_x + spd_x : pos_x) - fixed_reach),
+            WorldCellFixed((spd_x < 0 ? pos_x : pos_x + spd_x) + fixed_reach),
+            WorldCellFixed((spd_z < 0 ? pos_z + spd_z : pos_z) - fixed_reach),
+            WorldCellFixed((spd_z < 0 ? pos_z : pos_z + spd_z) + fixed_reach),
+        };
+    }
+
+    float pos_x = race->pos_x[i], spd_x = race->spd_x[i];
+    float pos_z = race->pos_z[i], spd_z = race->spd_z[i];
+
+    return (GridRect){
+        WorldCell(fminf(pos_x, pos_x + spd_x) - reach),
+        WorldCell(fmaxf(pos_x, pos_x + spd_x) + reach),
+        WorldCell(fminf(pos_z, pos_z + spd_z) - reach),
+        WorldCell(fmaxf(pos_z, pos_z + spd_z) + reach),
+    };
+}
+
+// Sweeps the move of the pod i against the moving hazards. Each hazard goes from where it is at the
+// clock of the pod to where it is on the next frame, so the pod is swept relative to it.
+static void SweepTraffic(const Level *level, const RaceState *race, int i, SweepResult *result, int64_t *toi)
+{
+    if (level->traffic_count == 0)
+        return;
+
+    const int UNIT = FIXED_ONE/OBJS_QUANT;
+
+    bool fixed = (level->physics_mode == PHYSICS_FIXED);
+    float reach = PLAYER_RAD + level->traffic_rad;
+    Fixed fixed_reach = fixed? FixedFromFloat(PLAYER_RAD) + FixedFromFloat(level->traffic_rad) : 0;
+
+    // Only x and z are swept
+    FixedVector3 fx_pos = {race->fx_pos_x[i], 0, race->fx_pos_z[i]};
+    FixedVector3 fx_spd = {race->fx_spd_x[i], 0, race->fx_spd_z[i]};
+    Vector3 pos = {race->pos_x[i], 0, race->pos_z[i]};
+    Vector3 spd = {race->spd_x[i], 0, race->spd_z[i]};
+
+    // Box covering the move of the pod and the hazards it can touch, in 1/OBJS_QUANT units.
+    // Hazards move less than a unit each frame, the margin also covers rounding.
+    int margin = (int) ((reach + 1)*OBJS_QUANT) + 2;
+    int x0, x1, z0, z1;
+
+    if (fixed)
+    {
+        x0 = (fx_spd.x < 0 ? fx_pos.x + fx_spd.x : fx_pos.x)/UNIT - margin;
+        x1 = (fx_spd.x < 0 ? fx_pos.x : fx_pos.x + fx_spd.x)/UNIT + margin;
+        z0 = (fx_spd.z < 0 ? fx_pos.z + fx_spd.z : fx_pos.z)/UNIT - margin;
+        z1 = (fx_spd.z < 0 ? fx_pos.z : fx_pos.z + fx_spd.z)/UNIT + margin;
+    }
+    else
+    {
+        x0 = (int) (fminf(pos.x, pos.x + spd.x)*OBJS_QUANT) - margin;
+        x1 = (int) (fmaxf(pos.x, pos.x + spd.x)*OBJS_QUANT) + margin;
+        z0 = (int) (fminf(pos.z, pos.z + spd.z)*OBJS_QUANT) - margin;
+        z1 = (int) (fmaxf(pos.z, pos.z + spd.z)*OBJS_QUANT) + margin;
+    }
+
+    GridRect cells = TrafficCells(level, x0, x1, z0, z1);
+
+    // The clock stays still before the pod lands and once it finished
+    int clock = race->time_playing[i];
+    int next_clock = clock + (clock > 0 && race->n_carrots[i] < TARGET_N_CARROTS);
+
+    SweepResult traffic = {1, false, false, false, false};
+    int64_t traffic_toi = FIXED_ONE;
+
+    for (int z = cells.z0; z <= cells.z1; ++z)
+    {
+        for (int x = cells.x0; x <= cells.x1; ++x)
+        {
+            int c = z*level->traffic_grid_w + x;
+
+            for (int k = level->traffic_start[c]; k < level->traffic_start[c + 1]; ++k)
+            {
+                int h = level->traffic_ids[k];
+
+                if (!TrafficLaneTouches(level, h, x0, x1, z0, z1))
+                    continue;
+
+                int offset = TrafficOffset(level, h, clock);
+                int move = TrafficOffset(level, h, next_clock) - offset;
+                int qx = level->traffic_qx[h] + level->traffic_dx[h]*offset;
+                int qz = level->traffic_qz[h] + level->traffic_dz[h]*offset;
+
+                if (fixed)
+                {
+                    FixedVector3 delta = fx_spd;
+
+                    delta.x -= level->traffic_dx[h]*move*UNIT;
+                    delta.z -= level->traffic_dz[h]*move*UNIT;
+
+                    SweepObstacleFixed(&traffic, &traffic_toi, fx_pos, delta, fixed_reach, qx*UNIT, qz*UNIT);
+                }
+                else
+                {
+                    Vector3 delta = spd;
+
+                    delta.x -= (float) (level->traffic_dx[h]*move)/OBJS_QUANT;
+                    delta.z -= (float) (level->traffic_dz[h]*move)/OBJS_QUANT;
+
+                    SweepObstacle(&traffic, pos, delta, reach, (float) qx/OBJS_QUANT, (float) qz/OBJS_QUANT);
+                }
+            }
+        }
+    }
+
+    if (traffic.hit)
+    {
+        result->toi = fminf(result->toi, traffic.toi);
+        result->hit = true;
+        result->hit_traffic = true;
+        *toi = Min64(*toi, traffic_toi);
+    }
+    result->hit_x = result->hit_x || traffic.hit_x;
+    result->hit_z = result->hit_z || traffic.hit_z;
+}
+
+// Sweeps the moves of every pod of the race against the obstacles, with the physics of the level.
+// Pods whose moves touch the same grid cells are grouped, and each group does a single pass over
+// its nearby obstacles, testing every pod of the group on each one.
+static void LevelSweepPods(Level *level, const RaceState *race, SweepResult *results)
+{
+    GridRect cells[RACE_MAX_PLAYERS];
+    int members[RACE_MAX_PLAYERS][RACE_MAX_PLAYERS];    // Pods of the group started by each pod
+    int members_count[RACE_MAX_PLAYERS];
+    int64_t tois[RACE_MAX_PLAYERS];
+
+    int count = race->players_count;
+    bool fixed = (level->physics_mode == PHYSICS_FIXED);
+    float reach = PLAYER_RAD + level->objs_rad;
+    Fixed fixed_reach = fixed? FixedFromFloat(PLAYER_RAD) + FixedFromFloat(level->objs_rad) : 0;
+
+    for (int i = 0; i < count; ++i)
+    {
+        results[i] = (SweepResult){1, false, false, false, false};
+        tois[i] = FIXED_ONE;
+        cells[i] = PodSweepCells(level, race, i, reach, fixed_reach);
+        members_count[i] = 0;
+
+        // Join the first group that shares cells with the pod, its cells grow to cover the pod
+        int g = i;
+
+        for (int j = 0; j < i && g == i; ++j)
+        {
+            if (members_count[j] > 0 && cells[i].x0 <= cells[j].x1 && cells[j].x0 <= cells[i].x1 &&
+                    cells[i].z0 <= cells[j].z1 && cells[j].z0 <= cells[i].z1)
+            {
+                cells[j] = (GridRect){mini(cells[i].x0, cells[j].x0), maxi(cells[i].x1, cells[j].x1),
+                        mini(cells[i].z0, cells[j].z0), maxi(cells[i].z1, cells[j].z1)};
+                g = j;
+            }
+        }
+        members[g][members_count[g]++] = i;
+    }
+
+    for (int g = 0; g < count; ++g)
+    {
+        const int *pods = members[g];
+        int n = members_count[g];
+
+        if (n == 0)
+            continue;
+
+        const LevelChunk *chunks[LEVEL_QUERY_CHUNKS];
+        int chunks_count = LevelChunksIn(level, cells[g], chunks);
+
+        for (int c = 0; c < chunks_count; ++c)
+        {
+            const LevelChunk *chunk = chunks[c];
+            GridRect rect = ChunkRect(chunk, cells[g]);
+
+            // Moves of the pods of the group, float positions are taken from the origin of the
+            // chunk like its obstacles
+            Vector3 local[RACE_MAX_PLAYERS], spd[RACE_MAX_PLAYERS];
+            FixedVector3 fx_pos[RACE_MAX_PLAYERS], fx_spd[RACE_MAX_PLAYERS];
+            Fixed origin_x = chunk->origin_x*FIXED_ONE;
+            Fixed origin_z = chunk->origin_z*FIXED_ONE;
+
+            for (int m = 0; m < n; ++m)
+            {
+                int i = pods[m];
+
+                if (fixed)
+                {
+                    fx_pos[m] = (FixedVector3){race->fx_pos_x[i], 0, race->fx_pos_z[i]};
+                    fx_spd[m] = (FixedVector3){race->fx_spd_x[i], 0, race->fx_spd_z[i]};
+                }
+                else
+                {
+                    local[m] = (Vector3){race->pos_x[i] - chunk->origin_x, 0, race->pos_z[i] - chunk->origin_z};
+                    spd[m] = (Vector3){race->spd_x[i], 0, race->spd_z[i]};
+                }
+            }
+
+            for (int z = rect.z0; z <= rect.z1; ++z)
+            {
+                int start = chunk->grid_start[z*chunk->grid_w + rect.x0];
+                int end = chunk->grid_start[z*chunk->grid_w + rect.x1 + 1];
+
+                for (int k = start; k < end; ++k)
+                {
+                    if (fixed)
+                    {
+                        Fixed obj_x = origin_x + chunk->objs_qx[k]*(FIXED_ONE/OBJS_QUANT);
+                        Fixed obj_z = origin_z + chunk->objs_qz[k]*(FIXED_ONE/OBJS_QUANT);
+
+                        for (int m = 0; m < n; ++m)
+                            SweepObstacleFixed(&results[pods[m]], &tois[pods[m]], fx_pos[m], fx_spd[m], fixed_reach, obj_x, obj_z);
+                    }
+                    else
+                    {
+                        float obj_x = (float) chunk->objs_qx[k]/OBJS_QUANT;
+                        float obj_z = (float) chunk->objs_qz[k]/OBJS_QUANT;
+
+                        for (int m = 0; m < n; ++m)
+                            SweepObstacle(&results[pods[m]], local[m], spd[m], reach, obj_x, obj_z);
+                    }
+                }
+            }
+        }
+    }
+
+    for (int i = 0; i < count; ++i)
+        SweepTraffic(level, race, i, &results[i], &tois[i]);
+
+    if (fixed)
+    {
+        for (int i = 0; i < count; ++i)
+            results[i].toi = FixedToFloat(tois[i]);
+    }
+}
+
+// Whether a carrot fits at the center of the cell. The carrot (of radius 2) only touches the 3x3
+// neighbour cells, so they must be free.
+static bool LevelIsSpawnCell(const Level *level, int x, int z)
+{
+    if ((x + 1)*GRID_CELL_SIZE >= level->map_size || (z + 1)*GRID_CELL_SIZE >= level->map_size)
+        return false;
+
+    return level->clearance[z*level->map.grid_w + x] >= CARROT_SPAWN_CLEARANCE;
+}
+
+static void LevelBuildClearance(Level *level)
+{
+    int w = level->map.grid_w;
+
+    level->clearance = SimAlloc(sizeof(*level->clearance) * w * w);
+    level->spawn_cells = SimAlloc(sizeof(*level->spawn_cells) * w * w);
+    assert(level->clearance && level->spawn_cells);
+
+    memset(level->clearance, 255, w * w);
+
+    // Cells touched by an obstacle have no clearance
+    for (int i = 0; i < level->map.objs_count; ++i)
+    {
+        float rad = OBSTACLE_RAD[level->map.objs[i].type];
+
+        int x0 = LevelGridCell(level, level->map.objs[i].pos.x - rad);
+        int x1 = LevelGridCell(level, level->map.objs[i].pos.x + rad);
+        int z0 = LevelGridCell(level, level->map.objs[i].pos.z - rad);
+        int z1 = LevelGridCell(level, level->map.objs[i].pos.z + rad);
+
+        for (int z = z0; z <= z1; ++z)
+            for (int x = x0; x <= x1; ++x)
+                level->clearance[z*w + x] = 0;
+    }
+
+    // Chessboard distance transform, one forward and one backward pass
+    for (int z = 0; z < w; ++z)
+    {
+        for (int x = 0; x < w; ++x)
+        {
+            int d = level->clearance[z*w + x];
+
+            if (x > 0)
+                d = mini(d, level->clearance[z*w + x - 1] + 1);
+            if (z > 0)
+            {
+                d = mini(d, level->clearance[(z - 1)*w + x] + 1);
+                if (x > 0)
+                    d = mini(d, level->clearance[(z - 1)*w + x - 1] + 1);
+                if (x < w - 1)
+                    d = mini(d, level->clearance[(z - 1)*w + x + 1] + 1);
+            }
+            level->clearance[z*w + x] = d;
+        }
+    }
+    for (int z = w - 1; z >= 0; --z)
+    {
+        for (int x = w - 1; x >= 0; --x)
+        {
+            int d = level->clearance[z*w + x];
+
+            if (x < w - 1)
+                d = mini(d, level->clearance[z*w + x + 1] + 1);
+            if (z < w - 1)
+            {
+                d = mini(d, level->clearance[(z + 1)*w + x] + 1);
+                if (x > 0)
+                    d = mini(d, level->clearance[(z + 1)*w + x - 1] + 1);
+                if (x < w - 1)
+                    d = mini(d, level->clearance[(z + 1)*w + x + 1] + 1);
+            }
+            level->clearance[z*w + x] = d;
+        }
+    }
+
+    level->spawn_cells_count = 0;
+    for (int z = 0; z < w; ++z)
+    {
+        for (int x = 0; x < w; ++x)
+        {
+            if (LevelIsSpawnCell(level, x, z))
+                level->spawn_cells[level->spawn_cells_count++] = z*w + x;
+        }
+    }
+    assert(level->spawn_cells_count > 0);
+}
+
+// Whether a hazard can go through the cell, which must be inside the map and free of obstacles
+static bool LevelIsLaneCell(const Level *level, int x, int z)
+{
+    if (x < 0 || z < 0 || (x + 1)*GRID_CELL_SIZE >= level->map_size || (z + 1)*GRID_CELL_SIZE >= level->map_size)
+        return false;
+
+    return level->clearance[z*level->map.grid_w + x] >= 1;
+}
+
+// Lays the lanes of the moving hazards, each along a run of free cells on x or z that goes
+// through a carrot spawn cell, and puts the hazard at a random point of its round trip
+static void LevelPlaceTraffic(Level *level, uint64_t *rng)
+{
+    const int MIN_LANE_CELLS = 4;
+    const int MAX_LANE_CELLS = 12;
+
+    int count = 0;
+    int min_spd = 0;
+    int max_spd = 0;
+
+    if (level->area == LEVEL_CITY)
+    {
+        count = N_MAP_TRAFFIC;
+        level->traffic_rad = 0.35;
+        min_spd = 3;
+        max_spd = 6;
+    }
+    else if (level->area == LEVEL_ICE)
+    {
+        count = N_MAP_TRAFFIC;
+        level->traffic_rad = 0.3;
+        min_spd = 1;
+        max_spd = 3;
+    }
+
+    level->traffic_qx = SimAlloc(sizeof(*level->traffic_qx) * (count + 1));
+    level->traffic_qz = SimAlloc(sizeof(*level->traffic_qz) * (count + 1));
+    level->traffic_dx = SimAlloc(sizeof(*level->traffic_dx) * (count + 1));
+    level->traffic_dz = SimAlloc(sizeof(*level->traffic_dz) * (count + 1));
+    level->traffic_len = SimAlloc(sizeof(*level->traffic_len) * (count + 1));
+    level->traffic_spd = SimAlloc(sizeof(*level->traffic_spd) * (count + 1));
+    level->traffic_phase = SimAlloc(sizeof(*level->traffic_phase) * (count + 1));
+    assert(level->traffic_qx && level->traffic_qz && level->traffic_dx && level->traffic_dz &&
+            level->traffic_len && level->traffic_spd && level->traffic_phase);
+
+    level->traffic_count = 0;
+
+    for (int attempt = 0; attempt < 8*count && level->traffic_count < count; ++attempt)
+    {
+        int cell = level->spawn_cells[RandomInt(rng, level->spawn_cells_count)];
+        int x = cell % level->map.grid_w;
+        int z = cell / level->map.grid_w;
+        int dx = RandomInt(rng, 2);
+        int dz = 1 - dx;
+
+        // Walk to the first free cell of the run, then to the last one
+        int first = 0;
+        int last = 0;
+
+        while (last - first < MAX_LANE_CELLS - 1 && LevelIsLaneCell(level, x + dx*(first - 1), z + dz*(first - 1)))
+            first--;
+        while (last - first < MAX_LANE_CELLS - 1 && LevelIsLaneCell(level, x + dx*(last + 1), z + dz*(last + 1)))
+            last++;
+
+        if (last - first + 1 < MIN_LANE_CELLS)
+            continue;
+
+        int i = level->traffic_count++;
+
+        level->traffic_qx[i] = Quantize((x + dx*first + 0.5f)*GRID_CELL_SIZE);
+        level->traffic_qz[i] = Quantize((z + dz*first + 0.5f)*GRID_CELL_SIZE);
+        level->traffic_dx[i] = dx;
+        level->traffic_dz[i] = dz;
+        level->traffic_len[i] = (last - first)*GRID_CELL_SIZE*OBJS_QUANT;
+        level->traffic_spd[i] = min_spd + RandomInt(rng, max_spd - min_spd + 1);
+        level->traffic_phase[i] = RandomInt(rng, 2*level->traffic_len[i]);
+    }
+}
+
+// Buckets the hazards by the coarse cells their lanes touch, the same way as LevelBuildGrid
+static void LevelBuildTrafficGrid(Level *level)
+{
+    level->traffic_grid_w = level->map_size/TRAFFIC_CELL_SIZE + 1;
+
+    int n_cells = level->traffic_grid_w * level->traffic_grid_w;
+    GridRect *lanes = SimAlloc(sizeof(*lanes) * (level->traffic_count + 1));
+
+    level->traffic_start = SimAlloc(sizeof(*level->traffic_start) * (n_cells + 1));
+    assert(lanes && level->traffic_start);
+
+    int entries = 0;
+
+    for (int i = 0; i < level->traffic_count; ++i)
+    {
+        int lane_x = level->traffic_qx[i];
+        int lane_z = level->traffic_qz[i];
+
+        lanes[i] = TrafficCells(level, lane_x, lane_x + level->traffic_dx[i]*level->traffic_len[i],
+                lane_z, lane_z + level->traffic_dz[i]*level->traffic_len[i]);
+
+        for (int z = lanes[i].z0; z <= lanes[i].z1; ++z)
+        {
+            for (int x = lanes[i].x0; x <= lanes[i].x1; ++x)
+            {
+                level->traffic_start[z*level->traffic_grid_w + x + 1]++;
+                entries++;
+            }
+        }
+    }
+    for (int c = 0; c < n_cells; ++c)
+        level->traffic_start[c + 1] += level->traffic_start[c];
+
+    level->traffic_ids = SimAlloc(sizeof(*level->traffic_ids) * (entries + 1));
+    assert(level->traffic_ids);
+
+    for (int i = 0; i < level->traffic_count; ++i)
+    {
+        for (int z = lanes[i].z0; z <= lanes[i].z1; ++z)
+            for (int x = lanes[i].x0; x <= lanes[i].x1; ++x)
+                level->traffic_ids[level->traffic_start[z*level->traffic_grid_w + x]++] = i;
+    }
+    for (int c = n_cells; c > 0; --c)
+        level->traffic_start[c] = level->traffic_start[c - 1];
+    level->traffic_start[0] = 0;
+
+    MemFree(lanes);
+}
+
+// Where every hazard is at the given race clock, which can be between two frames. A flat loop
+// over the arrays with no branches, that compilers turn into SIMD code.
+void LevelTrafficPositions(const Level *level, float clock, float *xs, float *zs)
+{
+    for (int i = 0; i < level->traffic_count; ++i)
+    {
+        float len = level->traffic_len[i];
+        float trip = clock*level->traffic_spd[i] + level->traffic_phase[i];
+
+        trip -= floorf(trip/(2*len))*2*len;
+
+        float offset = len - fabsf(trip - len);
+
+        xs[i] = (level->traffic_qx[i] + level->traffic_dx[i]*offset)/OBJS_QUANT;
+        zs[i] = (level->traffic_qz[i] + level->traffic_dz[i]*offset)/OBJS_QUANT;
+    }
+}
+
+static Vector3 LevelCellCenter(const Level *level, int cell)
+{
+    return (Vector3){(cell % level->map.grid_w + 0.5f)*GRID_CELL_SIZE, 0, (cell / level->map.grid_w + 0.5f)*GRID_CELL_SIZE};
+}
+
+// Point at the given step of the circle of radius CARROT_SPAN_DIST around a pod at pos (fx_pos
+// with fixed-point physics). On endless levels an axis that would take the point, or the chunk
+// around it, past the end of the world is mirrored, and clamped for pods right at the end, so
+// carrots can always be reached.
+static Vector3 CarrotCirclePoint(const Level *level, Vector3 pos, FixedVector3 fx_pos, int step, int steps)
+{
+    if (level->physics_mode == PHYSICS_FIXED)
+    {
+        const Fixed BOUND = (ENDLESS_WORLD_LIMIT - CHUNK_SIZE)*FIXED_ONE;
+
+        uint32_t angle = ((uint64_t) step << 32)/steps;
+        Fixed dx = CARROT_SPAN_DIST*FixedCos(angle);
+        Fixed dz = CARROT_SPAN_DIST*FixedSin(angle);
+
+        if (level->endless && FixedAbs(fx_pos.x + dx) > BOUND)
+            dx = -dx;
+        if (level->endless && FixedAbs(fx_pos.z + dz) > BOUND)
+            dz = -dz;
+
+        Fixed x = fx_pos.x + dx;
+        Fixed z = fx_pos.z + dz;
+
+        if (level->endless)
+        {
+            x = mini(maxi(x, -BOUND), BOUND);
+            z = mini(maxi(z, -BOUND), BOUND);
+        }
+
+        return (Vector3){FixedToFloat(x), 0, FixedToFloat(z)};
+    }
+
+    const float BOUND = ENDLESS_WORLD_LIMIT - CHUNK_SIZE;
+
+    float angle = 2*PI*step/steps;
+    float dx = CARROT_SPAN_DIST * cosf(angle);
+    float dz = CARROT_SPAN_DIST * sinf(angle);
+
+    if (level->endless && absf(pos.x + dx) > BOUND)
+        dx = -dx;
+    if (level->endless && absf(pos.z + dz) > BOUND)
+        dz = -dz;
+
+    Vector3 point = {pos.x + dx, 0, pos.z + dz};
+
+    if (level->endless)
+    {
+        point.x = Clamp(point.x, -BOUND, BOUND);
+        point.z = Clamp(point.z, -BOUND, BOUND);
+    }
+
+    return point;
+}
+
+// Place of the next carrot of a pod at pos, CARROT_SPAN_DIST away from it. The cells on that
+// circle are walked from a random angle until one has enough clearance, so the time spent is
+// bounded. On endless levels the carrot goes to the clearing of the chunk at a random point of the
+// circle, which is known without generating that chunk.
+static Vector3 CarrotSpawn(const Level *level, Vector3 pos, FixedVector3 fx_pos, uint64_t *rng)
+{
+    const int STEPS = 2*PI*CARROT_SPAN_DIST/GRID_CELL_SIZE + 1;
+
+    int first = RandomInt(rng, STEPS);
+
+    if (level->endless)
+    {
+        Vector3 point = CarrotCirclePoint(level, pos, fx_pos, first, STEPS);
+        int cx = (int) floorf(point.x/CHUNK_SIZE);
+        int cz = (int) floorf(point.z/CHUNK_SIZE);
+        uint64_t chunk_rng = ChunkSeed(level, cx, cz);
+
+        return ChunkClearing(cx, cz, &chunk_rng);
+    }
+
+    assert(CARROT_SPAN_DIST < 0.9 * level->map_size);
+
+    int cell = -1;
+
+    for (int s = 0; s < STEPS; ++s)
+    {
+        Vector3 point = CarrotCirclePoint(level, pos, fx_pos, (first + s) % STEPS, STEPS);
+
+        if (0 < point.x && point.x < level->map_size && 0 < point.z && point.z < level->map_size)
+        {
+            int x = LevelGridCell(level, point.x);
+            int z = LevelGridCell(level, point.z);
+
+            if (LevelIsSpawnCell(level, x, z))
+            {
+                cell = z*level->map.grid_w + x;
+                break;
+            }
+        }
+    }
+
+    // The circle is outside the map or blocked, any free cell will do
+    if (cell == -1)
+        cell = level->spawn_cells[RandomInt(rng, level->spawn_cells_count)];
+
+    return LevelCellCenter(level, cell);
+}
+
+// Spawns the next carrot of the player
+void LevelRespawnCarrot(const Level *level, Player *player)
+{
+    player->carrot_pos = CarrotSpawn(level, player->pos, player->fx_pos, &player->rng);
+    player->carrot_grab_anim = 0;
+}
+
+// Places the level obstacles by dart throwing (Poisson-disk sampling): a random candidate is
+// rejected when it gets too close to an obstacle that is already placed. Placed obstacles are
+// bucketed by GRID_CELL_SIZE cells, so each candidate is only checked against its 3x3 neighbour
+// cells and the whole placement runs in linear time.
+static void LevelPlaceObstacles(Level *level, ObstacleType type, uint64_t *rng)
+{
+    const float spacing_rad = 0.8 * OBSTACLE_RAD[type];
+
+    int cells_w = level->map_size/GRID_CELL_SIZE + 1;
+
+    int *cell_head = SimAlloc(sizeof(*cell_head) * cells_w * cells_w);
+    int *obj_next = SimAlloc(sizeof(*obj_next) * N_MAP_OBSTACLES);
+    assert(cell_head && obj_next);
+
+    for (int c = 0; c < cells_w * cells_w; ++c)
+        cell_head[c] = -1;
+
+    assert(spacing_rad + OBSTACLE_RAD[type] <= GRID_CELL_SIZE);
+
+    for (int i = 0; i < N_MAP_OBSTACLES; ++i)
+    {
+        Obstacle obs;
+        int cell_x, cell_z;
+
+        while (1)
+        {
+            obs = RandomObstacle(type, 0, 0, level->map_size, rng);
+
+            cell_x = (int) Clamp(floorf(obs.pos.x/GRID_CELL_SIZE), 0, cells_w - 1);
+            cell_z = (int) Clamp(floorf(obs.pos.z/GRID_CELL_SIZE), 0, cells_w - 1);
+
+            bool free = true;
+
+            for (int z = cell_z - 1; z <= cell_z + 1 && free; ++z)
+            {
+                for (int x = cell_x - 1; x <= cell_x + 1 && free; ++x)
+                {
+                    if (x < 0 || z < 0 || x >= cells_w || z >= cells_w)
+                        continue;
+
+                    for (int k = cell_head[z*cells_w + x]; k != -1; k = obj_next[k])
+                    {
+                        if (ObstacleOverlaps(&level->map.objs[k], obs.pos, spacing_rad))
+                        {
+                            free = false;
+                            break;
+                        }
+                    }
+                }
+            }
+
+            if (free)
+                break;
+        }
+
+        obj_next[level->map.objs_count] = cell_head[cell_z*cells_w + cell_x];
+        cell_head[cell_z*cells_w + cell_x] = level->map.objs_count;
+
+        level->map.objs[level->map.objs_count++] = obs;
+    }
+
+    MemFree(cell_head);
+    MemFree(obj_next);
+}
+
+// Generates the level for the given area, the same seed always produces the same level
+Level *LevelGenerate(LevelArea area, uint64_t seed)
+{
+    Level *level = SimAlloc(sizeof(*level));
+    assert(level);
+
+    level->area = area;
+    level->seed = seed;
+    level->physics = DEFAULT_PHYSICS;
+
+    uint64_t rng = seed;
+
+    level->map_size = MAP_SIZE;
+    if (area == LEVEL_FOREST)
+        level->map_size = MAP_SIZE_FOREST;
+
+    ObstacleType type = LevelObstacleType(area);
+
+    level->objs_rad = OBSTACLE_RAD[type];
+    level->map.size = level->map_size;
+    ChunkAlloc(&level->map, 1, level->map_size/GRID_CELL_SIZE + 1, N_MAP_OBSTACLES);
+
+    LevelPlaceObstacles(level, type, &rng);
+
+    ChunkBuildGrid(&level->map);
+    LevelBuildClearance(level);
+
+    LevelPlaceTraffic(level, &rng);
+    LevelBuildTrafficGrid(level);
+
+    return level;
+}
+
+// Generates an endless level for the given area, with the obstacle density of its map. Chunks are
+// generated when they are first needed, from the seed and their coordinates, and the level has no
+// moving hazards.
+Level *LevelGenerateEndless(LevelArea area, uint64_t seed)
+{
+    Level *level = SimAlloc(sizeof(*level));
+    ChunkCache *cache = SimAlloc(sizeof(*cache));
+    assert(level && cache);
+
+    level->area = area;
+    level->seed = seed;
+    level->physics = DEFAULT_PHYSICS;
+    level->endless = true;
+    level->chunks = cache;
+
+    int map_size = (area == LEVEL_FOREST)? MAP_SIZE_FOREST : MAP_SIZE;
+
+    level->objs_rad = OBSTACLE_RAD[LevelObstacleType(area)];
+    level->chunk_objs = N_MAP_OBSTACLES*CHUNK_SIZE*CHUNK_SIZE/(map_size*map_size);
+
+    ChunkAlloc(cache->slots, CHUNK_CACHE_SLOTS, CHUNK_SIZE/GRID_CELL_SIZE, level->chunk_objs);
+
+    for (int e = 0; e < CHUNK_TABLE_SIZE; ++e)
+        cache->table[e] = -1;
+
+    return level;
+}
+
+// Loads the chunks of an endless level around pos, the nearest first, generating at most budget
+// of them, and marks them as used so they stay loaded. Called once per frame for each view, so the
+// chunks a pod reaches are usually loaded before a collision query needs them.
+void LevelStreamChunks(Level *level, Vector3 pos, int budget)
+{
+    if (!level->endless)
+        return;
+
+    int cx = (int) floorf(pos.x/CHUNK_SIZE);
+    int cz = (int) floorf(pos.z/CHUNK_SIZE);
+
+    for (int ring = 0; ring <= CHUNK_STREAM_RADIUS; ++ring)
+    {
+        for (int z = cz - ring; z <= cz + ring; ++z)
+        {
+            for (int x = cx - ring; x <= cx + ring; ++x)
+            {
+                if (abs(x - cx) != ring && abs(z - cz) != ring)
+                    continue;
+
+                bool loaded = (LevelChunkLoaded(level, x, z) != NULL);
+
+                if (!loaded && budget == 0)
+                    continue;
+
+                budget -= !loaded;
+                LevelChunkAt(level, x, z);
+            }
+        }
+    }
+}
+
+// Chunks with obstacles closer than dist to pos on both axes, for drawing. Only the ones already
+// loaded are given, the map alone on levels of fixed size. Returns how many were written.
+int LevelChunksNear(const Level *level, Vector3 pos, float dist, const LevelChunk **chunks, int max)
+{
+    if (!level->endless)
+    {
+        chunks[0] = &level->map;
+        return 1;
+    }
+
+    int count = 0;
+
+    for (int cz = (int) floorf((pos.z - dist)/CHUNK_SIZE); cz <= (int) floorf((pos.z + dist)/CHUNK_SIZE); ++cz)
+    {
+        for (int cx = (int) floorf((pos.x - dist)/CHUNK_SIZE); cx <= (int) floorf((pos.x + dist)/CHUNK_SIZE); ++cx)
+        {
+            const LevelChunk *chunk = LevelChunkLoaded(level, cx, cz);
+
+            if (chunk && count < max)
+                chunks[count++] = chunk;
+        }
+    }
+    return count;
+}
+
+void UnloadLevel(Level *level)
+{
+    // The slots of the chunk cache share the arrays of the first one
+    LevelChunk *chunk = level->endless? &level->chunks->slots[0] : &level->map;
+
+    MemFree(chunk->grid_start);
+    MemFree(chunk->grid_objs);
+    MemFree(chunk->objs_qx);
+    MemFree(chunk->objs_qz);
+    MemFree(chunk->objs);
+    MemFree(level->chunks);
+    MemFree(level->clearance);
+    MemFree(level->spawn_cells);
+    MemFree(level->traffic_qx);
+    MemFree(level->traffic_qz);
+    MemFree(level->traffic_dx);
+    MemFree(level->traffic_dz);
+    MemFree(level->traffic_len);
+    MemFree(level->traffic_spd);
+    MemFree(level->traffic_phase);
+    MemFree(level->traffic_start);
+    MemFree(level->traffic_ids);
+    MemFree(level);
+}
+
+void InitPlayer(const Level *level, Player *player)
+{
+    memset(player, 0, sizeof(*player));
+
+    if (level->endless)
+    {
+        // There is no side to come from, the pod drops on the clearing of the first chunk
+        uint64_t rng = ChunkSeed(level, 0, 0);
+        Vector3 clearing = ChunkClearing(0, 0, &rng);
+
+        player->pos = (Vector3){clearing.x, 100, clearing.z};
+        player->fx_pos = (FixedVector3){(int) clearing.x*FIXED_ONE, 100*FIXED_ONE, (int) clearing.z*FIXED_ONE};
+    }
+    else
+    {
+        player->pos.x = -10;
+        player->pos.z = level->map_size/2.0;
+        player->pos.y = 100;
+        player->fx_pos = (FixedVector3){-10*FIXED_ONE, 100*FIXED_ONE, level->map_size*FIXED_ONE/2};
+    }
+
+    // Carrots follow their own sequence, apart from the one used to generate the level
+    player->rng = level->seed ^ 0x5851f42d4c957f2dULL;
+
+    LevelRespawnCarrot(level, player);
+}
+
+// Fraction of the move from a to b done when it first gets within dist of target
+static float MoveFractionToReach(Vector3 a, Vector3 b, Vector3 target, float dist)
+{
+    Vector3 move = Vector3Subtract(b, a);
+    Vector3 rel = Vector3Subtract(a, target);
+
+    float qa = Vector3DotProduct(move, move);
+    float qb = 2*Vector3DotProduct(move, rel);
+    float qc = Vector3DotProduct(rel, rel) - dist*dist;
+    float disc = qb*qb - 4*qa*qc;
+
+    if (qc <= 0)
+        return 0;
+    if (qa == 0 || disc < 0)
+        return 1;
+
+    return Clamp((-qb - sqrtf(disc))/(2*qa), 0, 1);
+}
+
+// MoveFractionToReach in fixed point. Moves are taken in 1/256 units, so the products fit in
+// 64 bits for moves of up to 100 units.
+static Fixed FixedMoveFractionToReach(FixedVector3 a, FixedVector3 b, FixedVector3 target, Fixed dist)
+{
+    const int SCALE = FIXED_ONE/256;
+
+    FixedVector3 move = FixedVector3Subtract(b, a);
+    FixedVector3 rel = FixedVector3Subtract(a, target);
+
+    move = (FixedVector3){move.x/SCALE, move.y/SCALE, move.z/SCALE};
+    rel = (FixedVector3){rel.x/SCALE, rel.y/SCALE, rel.z/SCALE};
+    dist /= SCALE;
+
+    int64_t qa = FixedDot(move, move);
+    int64_t qb = 2*FixedDot(move, rel);
+    int64_t qc = FixedDot(rel, rel) - (int64_t) dist*dist;
+
+    int64_t disc = qb*qb - 4*qa*qc;
+
+    if (qc <= 0)
+        return 0;
+    if (qa == 0 || disc < 0)
+        return FIXED_ONE;
+
+    int64_t root = FixedIntSqrt(disc);
+    int64_t fraction = (-qb - root)*FIXED_ONE/(2*qa);
+
+    return (Fixed) Max64(0, Min64(fraction, FIXED_ONE));
+}
+
+// Constants of the fixed-point physics of a level, converted once per frame for all the pods
+typedef struct
+{
+    Fixed ang_accel, accel;
+    int64_t ang_gain;           // Binary angle per frame for each unit of turbo difference
+    int64_t crash_speed;
+    int64_t grab_dist;
+} FixedPhysics;
+
+static FixedPhysics LevelFixedPhysics(const Level *level)
+{
+    const float RAD_TO_BINARY = 4294967296.0f/(2*PI);
+    const PhysicsParams *physics = &level->physics;
+
+    // Rounded like llroundf, inline as in FixedFromFloat
+    double ang_gain = (float) (physics->ang_gain*RAD_TO_BINARY);
+
+    return (FixedPhysics){
+        FixedFromFloat(physics->accel),
+        FixedFromFloat((level->area == LEVEL_ICE)? physics->ice_accel : physics->accel),
+        (int64_t) ((ang_gain < 0)? ang_gain - 0.5 : ang_gain + 0.5),
+        FixedFromFloat(physics->crash_speed),
+        FixedFromFloat(PLAYER_RAD + CARROT_RAD),
+    };
+}
+
+// Takes the float state of the pod i from its fixed-point one, for everything but the physics
+static void PodSyncFixed(RaceState *race, int i)
+{
+    race->ang[i] = (float) (race->fx_ang[i] >> 8)*(2*PI/16777216);
+    race->ang_spd[i] = (float) race->fx_ang_spd[i]*(2*PI/4294967296.0f);
+    race->pos_x[i] = FixedToFloat(race->fx_pos_x[i]);
+    race->pos_y[i] = FixedToFloat(race->fx_pos_y[i]);
+    race->pos_z[i] = FixedToFloat(race->fx_pos_z[i]);
+    race->spd_x[i] = FixedToFloat(race->fx_spd_x[i]);
+    race->spd_y[i] = FixedToFloat(race->fx_spd_y[i]);
+    race->spd_z[i] = FixedToFloat(race->fx_spd_z[i]);
+}
+
+// Spawns the next carrot of the pod i, once it grabbed one
+static void PodGrabCarrot(const Level *level, RaceState *race, int i)
+{
+    Vector3 pos = {race->pos_x[i], race->pos_y[i], race->pos_z[i]};
+    FixedVector3 fx_pos = {race->fx_pos_x[i], race->fx_pos_y[i], race->fx_pos_z[i]};
+
+    race->n_carrots[i]++;
+    race->carrot_pos[i] = CarrotSpawn(level, pos, fx_pos, &race->rng[i]);
+    race->carrot_grab_anim[i] = 1;
+}
+
+// Race clock and carrot grab animation of the pod i, the last part of a frame on both physics modes
+static int PodUpdateClock(RaceState *race, int i)
+{
+    int events = SIM_EVENT_NONE;
+
+    // Increment the clock
+    if (race->time_playing[i] && race->n_carrots[i] < TARGET_N_CARROTS)
+    {
+        race->time_playing[i]++;
+    }
+
+    if (race->carrot_grab_anim[i] > PLAYER_CARROT_GRAB_ANIMATION_TIME)
+    {
+        if (race->n_carrots[i] >= TARGET_N_CARROTS)
+        {
+            events |= SIM_EVENT_FINISH;
+        }
+        else
+        {
+            events |= SIM_EVENT_CARROT_END;
+            race->carrot_grab_anim[i] = 0;
+        }
+    }
+    if (race->carrot_grab_anim[i])
+        race->carrot_grab_anim[i]++;
+
+    return events;
+}
+
+// The physics of the fixed-point mode are the same as the float ones, step by step, with integer
+// operations and table trigonometry only
+static void PodUpdateSpeedFixed(const FixedPhysics *physics, RaceState *race, int i, PlayerInput input)
+{
+    const Fixed DAMPING = 0.95*FIXED_ONE;
+    const Fixed TURN_LOSS = 0.4*FIXED_ONE;
+    const Fixed FRONT_GAIN = 0.1*FIXED_ONE;
+
+    FixedVector3 pos_spd = {race->fx_spd_x[i], race->fx_spd_y[i], race->fx_spd_z[i]};
+
+    if (race->n_carrots[i] == TARGET_N_CARROTS)
+    {
+        pos_spd = FixedVector3Scale(pos_spd, DAMPING);
+        race->fx_ang_spd[i] = FixedMul(race->fx_ang_spd[i], DAMPING);
+    }
+    else if (race->time_death[i])
+    {
+        race->time_death[i]++;
+
+        pos_spd = FixedVector3Scale(pos_spd, DAMPING);
+        race->fx_ang_spd[i] = FixedMul(race->fx_ang_spd[i], DAMPING);
+    }
+    else
+    {
+        // React to controls
+        race->turbo_l[i] = input.turbo_l;
+        race->turbo_r[i] = input.turbo_r;
+
+        Fixed turbo_l = FixedFromFloat(input.turbo_l);
+        Fixed turbo_r = FixedFromFloat(input.turbo_r);
+
+        // Target velocity
+        int32_t tgt_ang_spd = (int32_t) ((turbo_r - turbo_l)*physics->ang_gain/FIXED_ONE);
+        Fixed tgt_front_spd = FixedMul(turbo_l + turbo_r - FixedMul(TURN_LOSS, FixedAbs(turbo_r - turbo_l)), FRONT_GAIN);
+        FixedVector3 tgt_spd = {FixedMul(tgt_front_spd, FixedCos(race->fx_ang[i])), -10*FIXED_ONE,
+                -FixedMul(tgt_front_spd, FixedSin(race->fx_ang[i]))};
+
+        // Accelerate towards target velocity
+        race->fx_ang_spd[i] = FixedLerp(race->fx_ang_spd[i], tgt_ang_spd, physics->ang_accel);
+        pos_spd.x = FixedLerp(pos_spd.x, tgt_spd.x, physics->accel);
+        pos_spd.y = FixedLerp(pos_spd.y, tgt_spd.y, physics->accel);
+        pos_spd.z = FixedLerp(pos_spd.z, tgt_spd.z, physics->accel);
+    }
+
+    // Collide with floor
+    if (race->fx_pos_y[i] + pos_spd.y < 0)
+    {
+        race->fx_pos_y[i] = 0;
+        pos_spd.y = 0;
+        if (race->time_playing[i] == 0)
+            race->time_playing[i] = 1;
+    }
+
+    race->fx_spd_x[i] = pos_spd.x;
+    race->fx_spd_y[i] = pos_spd.y;
+    race->fx_spd_z[i] = pos_spd.z;
+}
+
+static int PodUpdateMoveFixed(const Level *level, const FixedPhysics *physics, RaceState *race, int i, SweepResult sweep)
+{
+    int events = SIM_EVENT_NONE;
+
+    // Mario Kart 64 collision
+    FixedVector3 pos_spd = {race->fx_spd_x[i], race->fx_spd_y[i], race->fx_spd_z[i]};
+    FixedVector3 old_pos_spd = pos_spd;
+
+    if (sweep.hit)
+    {
+        bool removed_x = false;
+        bool removed_z = false;
+
+        // Remove one speed component
+        if (FixedAbs(pos_spd.x) >= FixedAbs(pos_spd.y))
+        {
+            if (sweep.hit_x)
+                removed_x = true;
+            else if (sweep.hit_z)
+                removed_z = true;
+        }
+        else
+        {
+            if (sweep.hit_z)
+                removed_z = true;
+            else if (sweep.hit_x)
+                removed_x = true;
+        }
+
+        if (removed_x)
+            pos_spd.x = 0;
+        if (removed_z)
+            pos_spd.z = 0;
+
+        // Halt, if the move along the remaining component also collides
+        if ((removed_x && sweep.hit_z) || (removed_z && sweep.hit_x) || (!removed_x && !removed_z))
+        {
+            pos_spd.x = 0;
+            pos_spd.z = 0;
+        }
+
+        if (!race->time_death[i] && race->n_carrots[i] < TARGET_N_CARROTS)
+        {
+            // Is collision fatal? Compared squared, in 32.32 fixed point. Hazards always are
+            FixedVector3 change = FixedVector3Subtract(pos_spd, old_pos_spd);
+
+            if (FixedDot(change, change) > physics->crash_speed*physics->crash_speed || sweep.hit_traffic)
+            {
+                race->time_death[i] += 1;
+                events |= SIM_EVENT_CRASH;
+            }
+        }
+    }
+
+    // Move according to speed
+    FixedVector3 old_pos = {race->fx_pos_x[i], race->fx_pos_y[i], race->fx_pos_z[i]};
+    FixedVector3 pos = FixedVector3Add(old_pos, pos_spd);
+
+    // Endless levels end before 16.16 positions overflow, the pod stops there as if sliding along
+    // a wall, without crashing
+    if (level->endless)
+    {
+        const Fixed LIMIT = ENDLESS_WORLD_LIMIT*FIXED_ONE;
+
+        if (FixedAbs(pos.x) > LIMIT)
+        {
+            pos.x = (pos.x < 0)? -LIMIT : LIMIT;
+            pos_spd.x = 0;
+        }
+        if (FixedAbs(pos.z) > LIMIT)
+        {
+            pos.z = (pos.z < 0)? -LIMIT : LIMIT;
+            pos_spd.z = 0;
+        }
+    }
+
+    race->fx_ang[i] += (uint32_t) race->fx_ang_spd[i];
+    race->fx_pos_x[i] = pos.x;
+    race->fx_pos_y[i] = pos.y;
+    race->fx_pos_z[i] = pos.z;
+    race->fx_spd_x[i] = pos_spd.x;
+    race->fx_spd_y[i] = pos_spd.y;
+    race->fx_spd_z[i] = pos_spd.z;
+
+    if (race->time_death[i] >= PLAYER_DEATH_ANIMATION_TIME)
+        events |= SIM_EVENT_GAME_OVER;
+
+    Vector3 carrot_pos = race->carrot_pos[i];
+    FixedVector3 carrot = {FixedFromFloat(carrot_pos.x), FixedFromFloat(carrot_pos.y), FixedFromFloat(carrot_pos.z)};
+    FixedVector3 to_carrot = FixedVector3Subtract(carrot, pos);
+
+    if (FixedDot(to_carrot, to_carrot) <= physics->grab_dist*physics->grab_dist)
+    {
+        // The clock stops at the moment of the frame the pod touched the last carrot
+        if (race->n_carrots[i] + 1 == TARGET_N_CARROTS)
+            race->time_finish[i] = race->time_playing[i] + FixedToFloat(FixedMoveFractionToReach(old_pos, pos, carrot, physics->grab_dist));
+
+        PodGrabCarrot(level, race, i);
+        events |= SIM_EVENT_CARROT;
+    }
+
+    events |= PodUpdateClock(race, i);
+
+    PodSyncFixed(race, i);
+
+    return events;
+}
+
+// First part of a frame: the pod i speeds up following the controls and lands on the floor
+static void PodUpdateSpeed(const Level *level, RaceState *race, int i, PlayerInput input)
+{
+
+    Vector3 pos_spd = {race->spd_x[i], race->spd_y[i], race->spd_z[i]};
+
+    if (race->n_carrots[i] == TARGET_N_CARROTS)
+    {
+        pos_spd = Vector3Scale(pos_spd, 0.95);
+        race->ang_spd[i] *= 0.95;
+    }
+    else if (race->time_death[i])
+    {
+        race->time_death[i]++;
+
+        pos_spd = Vector3Scale(pos_spd, 0.95);
+        race->ang_spd[i] *= 0.95;
+    }
+    else
+    {
+        // React to controls
+        race->turbo_l[i] = input.turbo_l;
+        race->turbo_r[i] = input.turbo_r;
+
+        const PhysicsParams *physics = &level->physics;
+
+        // Target velocity
+        float tgt_ang_spd = (input.turbo_r - input.turbo_l) * physics->ang_gain;
+        float tgt_front_spd = (input.turbo_l + input.turbo_r - 0.4*absf(input.turbo_r - input.turbo_l)) * 0.1;
+        Vector3 tgt_spd = (Vector3){tgt_front_spd*cosf(race->ang[i]), -10, -tgt_front_spd*sinf(race->ang[i])};
+
+        // Accelerate towards target velocity (not phyisically accurate at all)
+        float accel = (level->area == LEVEL_ICE)? physics->ice_accel : physics->accel;
+
+        race->ang_spd[i] = (1 - physics->accel) * race->ang_spd[i] + physics->accel * tgt_ang_spd;
+        pos_spd = Vector3Add(Vector3Scale(pos_spd, 1 - accel), Vector3Scale(tgt_spd, accel));
+    }
+
+    // Collide with floor
+    if (race->pos_y[i] + pos_spd.y < 0)
+    {
+        race->pos_y[i] = 0;
+        pos_spd.y = 0;
+        if (race->time_playing[i] == 0)
+            race->time_playing[i] = 1;
+    }
+
+    race->spd_x[i] = pos_spd.x;
+    race->spd_y[i] = pos_spd.y;
+    race->spd_z[i] = pos_spd.z;
+}
+
+// Rest of the frame of the pod i, once its move was swept against the obstacles: collisions,
+// carrots and clock. Returns the SimEvent flags of what happened.
+static int PodUpdateMove(const Level *level, RaceState *race, int i, SweepResult sweep)
+{
+    int events = SIM_EVENT_NONE;
+
+    // Mario Kart 64 collision
+    Vector3 pos_spd = {race->spd_x[i], race->spd_y[i], race->spd_z[i]};
+    Vector3 old_pos_spd = pos_spd;
+
+    if (sweep.hit)
+    {
+        bool removed_x = false;
+        bool removed_z = false;
+
+        // Remove one speed component
+        if (absf(pos_spd.x) >= absf(pos_spd.y))
+        {
+            if (sweep.hit_x)
+                removed_x = true;
+            else if (sweep.hit_z)
+                removed_z = true;
+        }
+        else
+        {
+            if (sweep.hit_z)
+                removed_z = true;
+            else if (sweep.hit_x)
+                removed_x = true;
+        }
+
+        if (removed_x)
+            pos_spd.x = 0;
+        if (removed_z)
+            pos_spd.z = 0;
+
+        // Halt, if the move along the remaining component also collides
+        if ((removed_x && sweep.hit_z) || (removed_z && sweep.hit_x) || (!removed_x && !removed_z))
+        {
+            pos_spd.x = 0;
+            pos_spd.z = 0;
+        }
+
+        if (!race->time_death[i] && race->n_carrots[i] < TARGET_N_CARROTS)
+        {
+            // Is collision fatal? Hazards always are
+            float collision_magnitude = Vector3Distance(pos_spd, old_pos_spd);
+
+            if (collision_magnitude > level->physics.crash_speed || sweep.hit_traffic)
+            {
+                race->time_death[i] += 1;
+                events |= SIM_EVENT_CRASH;
+            }
+        }
+    }
+
+    // Move according to speed
+    Vector3 old_pos = {race->pos_x[i], race->pos_y[i], race->pos_z[i]};
+    Vector3 pos = Vector3Add(old_pos, pos_spd);
+
+    // Same end of the world as with fixed-point physics
+    if (level->endless)
+    {
+        const float LIMIT = ENDLESS_WORLD_LIMIT;
+
+        if (absf(pos.x) > LIMIT)
+        {
+            pos.x = (pos.x < 0)? -LIMIT : LIMIT;
+            pos_spd.x = 0;
+        }
+        if (absf(pos.z) > LIMIT)
+        {
+            pos.z = (pos.z < 0)? -LIMIT : LIMIT;
+            pos_spd.z = 0;
+        }
+    }
+
+    race->ang[i] = fremf(race->ang[i] + race->ang_spd[i], 2*PI);
+    race->pos_x[i] = pos.x;
+    race->pos_y[i] = pos.y;
+    race->pos_z[i] = pos.z;
+    race->spd_x[i] = pos_spd.x;
+    race->spd_y[i] = pos_spd.y;
+    race->spd_z[i] = pos_spd.z;
+
+    if (race->time_death[i] >= PLAYER_DEATH_ANIMATION_TIME)
+        events |= SIM_EVENT_GAME_OVER;
+
+    if (Vector3Distance(pos, race->carrot_pos[i]) <= PLAYER_RAD + CARROT_RAD)
+    {
+        // The clock stops at the moment of the frame the pod touched the last carrot
+        if (race->n_carrots[i] + 1 == TARGET_N_CARROTS)
+            race->time_finish[i] = race->time_playing[i] + MoveFractionToReach(old_pos, pos, race->carrot_pos[i], PLAYER_RAD + CARROT_RAD);
+
+        PodGrabCarrot(level, race, i);
+        events |= SIM_EVENT_CARROT;
+    }
+
+    events |= PodUpdateClock(race, i);
+
+    return events;
+}
+
+// Copies the pod i of the race, gathered from its arrays, to player
+static void PodGather(const RaceState *race, int i, Player *player)
+{
+    player->ang = race->ang[i];
+    player->ang_spd = race->ang_spd[i];
+    player->pos = (Vector3){race->pos_x[i], race->pos_y[i], race->pos_z[i]};
+    player->pos_spd = (Vector3){race->spd_x[i], race->spd_y[i], race->spd_z[i]};
+    player->turbo_l = race->turbo_l[i];
+    player->turbo_r = race->turbo_r[i];
+    player->time_death = race->time_death[i];
+    player->n_carrots = race->n_carrots[i];
+    player->carrot_pos = race->carrot_pos[i];
+    player->carrot_grab_anim = race->carrot_grab_anim[i];
+    player->time_playing = race->time_playing[i];
+    player->time_finish = race->time_finish[i];
+    player->rng = race->rng[i];
+    player->fx_ang = race->fx_ang[i];
+    player->fx_ang_spd = race->fx_ang_spd[i];
+    player->fx_pos = (FixedVector3){race->fx_pos_x[i], race->fx_pos_y[i], race->fx_pos_z[i]};
+    player->fx_pos_spd = (FixedVector3){race->fx_spd_x[i], race->fx_spd_y[i], race->fx_spd_z[i]};
+}
+
+// Advances the player one frame, returns the SimEvent flags of what happened. It is a race of a
+// single pod, so both give the same results. The player is copied in and out of the race on each
+// call, code that runs a pod for many frames keeps a RaceState of one pod instead.
+int UpdatePlayer(Level *level, Player *player, PlayerInput input)
+{
+    RaceState race;
+    int events;
+
+    race.players_count = 1;
+    race.frame = 0;
+    RaceSetPlayer(&race, 0, player);
+
+    UpdateRace(level, &race, &input, &events);
+
+    PodGather(&race, 0, player);
+
+    return events;
+}
+
+void InitRace(const Level *level, RaceState *race, int players_count)
+{
+    memset(race, 0, sizeof(*race));
+    race->players_count = players_count;
+
+    for (int i = 0; i < players_count; ++i)
+    {
+        Player player;
+
+        InitPlayer(level, &player);
+        RaceSetPlayer(race, i, &player);
+    }
+}
+
+// Advances every pod one frame with inputs[i], the SimEvent flags of each one are stored in
+// events[i] unless events is NULL. Pods don't touch each other, so this is the same as updating
+// them one by one, but each phase goes through all of them: the level constants are converted
+// once and the collisions of all of them are found in one pass.
+void UpdateRace(Level *level, RaceState *race, const PlayerInput *inputs, int *events)
+{
+    SweepResult sweeps[RACE_MAX_PLAYERS];
+    int pod_events[RACE_MAX_PLAYERS];
+    int count = race->players_count;
+
+    if (level->physics_mode == PHYSICS_FIXED)
+    {
+        FixedPhysics physics = LevelFixedPhysics(level);
+
+        for (int i = 0; i < count; ++i)
+            PodUpdateSpeedFixed(&physics, race, i, inputs[i]);
+
+        LevelSweepPods(level, race, sweeps);
+
+        for (int i = 0; i < count; ++i)
+            pod_events[i] = PodUpdateMoveFixed(level, &physics, race, i, sweeps[i]);
+    }
+    else
+    {
+        for (int i = 0; i < count; ++i)
+            PodUpdateSpeed(level, race, i, inputs[i]);
+
+        LevelSweepPods(level, race, sweeps);
+
+        for (int i = 0; i < count; ++i)
+            pod_events[i] = PodUpdateMove(level, race, i, sweeps[i]);
+    }
+
+    for (int i = 0; i < count && events; ++i)
+        events[i] = pod_events[i];
+
+    race->frame++;
+}
+
+// Pod index of the race, gathered from its arrays
+Player RacePlayer(const RaceState *race, int index)
+{
+    Player player;
+
+    PodGather(race, index, &player);
+
+    return player;
+}
+
+// Puts the player as the pod index of the race, scattered to its arrays
+void RaceSetPlayer(RaceState *race, int index, const Player *player)
+{
+    int i = index;
+
+    race->ang[i] = player->ang;
+    race->ang_spd[i] = player->ang_spd;
+    race->pos_x[i] = player->pos.x;
+    race->pos_y[i] = player->pos.y;
+    race->pos_z[i] = player->pos.z;
+    race->spd_x[i] = player->pos_spd.x;
+    race->spd_y[i] = player->pos_spd.y;
+    race->spd_z[i] = player->pos_spd.z;
+    race->turbo_l[i] = player->turbo_l;
+    race->turbo_r[i] = player->turbo_r;
+    race->time_death[i] = player->time_death;
+    race->n_carrots[i] = player->n_carrots;
+    race->carrot_pos[i] = player->carrot_pos;
+    race->carrot_grab_anim[i] = player->carrot_grab_anim;
+    race->time_playing[i] = player->time_playing;
+    race->time_finish[i] = player->time_finish;
+    race->rng[i] = player->rng;
+    race->fx_ang[i] = player->fx_ang;
+    race->fx_ang_spd[i] = player->fx_ang_spd;
+    race->fx_pos_x[i] = player->fx_pos.x;
+    race->fx_pos_y[i] = player->fx_pos.y;
+    race->fx_pos_z[i] = player->fx_pos.z;
+    race->fx_spd_x[i] = player->fx_pos_spd.x;
+    race->fx_spd_y[i] = player->fx_pos_spd.y;
+    race->fx_spd_z[i] = player->fx_pos_spd.z;
+}
+
+// Pod between two consecutive simulated frames, to draw it at any time between them.
+// Everything but its position and angle is taken from next.
+Player InterpolatePlayer(const Player *prev, const Player *next, float t)
+{
+    Player player = *next;
+
+    float turn = fremf(next->ang - prev->ang + PI, 2*PI) - PI;
+
+    player.pos = Vector3Lerp(prev->pos, next->pos, t);
+    player.ang = fremf(prev->ang + t*turn, 2*PI);
+
+    return player;
+}
+
+float CarrotAngle(const Player *player)
+{
+    float angle = atan2f(- (player->carrot_pos.z - player->pos.z), player->carrot_pos.x - player->pos.x);
+    if (angle < 0)
+        angle += 2*PI;
+
+    float delta = angle - player->ang;
+
+    if (delta < -PI)
+        return 2*PI + delta;
+
+    if (delta > PI)
+        return delta - 2*PI;
+
+    return delta;
+}
+
+float CarrotDistance(const Player *player)
+{
+    return Vector3Distance(player->pos, player->carrot_pos);
+}
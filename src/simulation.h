@@ -0,0 +1,295 @@
+/*******************************************************************************************
+*
+*   Nokia Pod Racer
+*   Race simulation: level generation, collisions and pod physics.
+*
+*   It doesn't read input, play audio or use the screen globals, so races can also be
+*   simulated headless and much faster than real time.
+*
+*   Copyright (c) 2023 Francisco Casas (@autopawn)
+*
+********************************************************************************************/
+
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include "raylib.h"
+#include "screens.h"
+#include "fixed.h"
+
+#include <stdint.h>
+
+//----------------------------------------------------------------------------------
+// Simulation constants
+//----------------------------------------------------------------------------------
+static const int SIM_FPS = 60;                  // Simulation steps per second of race
+static const int MAP_SIZE = 500;
+static const int MAP_SIZE_FOREST = 300;
+static const int N_MAP_OBSTACLES = 4000;
+static const int PLAYER_DEATH_ANIMATION_TIME = 200;
+static const int PLAYER_CARROT_GRAB_ANIMATION_TIME = 60;
+static const int CARROT_SPAN_DIST = 200;
+static const int TARGET_N_CARROTS = 5;
+static const int GRID_CELL_SIZE = 2;
+static const int OBJS_QUANT = 32;
+static const int CARROT_SPAWN_CLEARANCE = 2;
+static const int N_MAP_TRAFFIC = 400;
+static const int TRAFFIC_CELL_SIZE = 16;
+static const int CHUNK_SIZE = 32;               // Side of the chunks of endless levels
+static const int CHUNK_STREAM_RADIUS = 2;       // Chunks around a pod kept loaded, enough to draw it
+static const int ENDLESS_WORLD_LIMIT = 30000;   // Endless levels end this far from the start on x and z
+
+#define RACE_MAX_PLAYERS MAX_LOCAL_PLAYERS
+
+static const float PLAYER_RAD = 0.26;
+static const float CARROT_RAD = 0.24;
+
+//----------------------------------------------------------------------------------
+// Types and Structures Definition
+//----------------------------------------------------------------------------------
+typedef enum
+{
+    OBSTACLE_BUILDING,
+    OBSTACLE_TREE,
+    OBSTACLE_LAMP,
+    OBSTACLE_IGLOO,
+} ObstacleType;
+
+static const float OBSTACLE_RAD[] = {
+    0.5,
+    0.2,
+    0.125,
+    1.0,
+};
+
+typedef struct
+{
+    ObstacleType type;
+    Vector3 pos;
+} Obstacle;
+
+typedef struct
+{
+    float toi;      // Fraction of the move done before the first impact, 1 if there is none
+    bool hit;       // The whole move collides
+    bool hit_x;     // The move along x alone collides
+    bool hit_z;     // The move along z alone collides
+    bool hit_traffic;   // The move touches a moving hazard, which always crashes the pod
+} SweepResult;
+
+// Pod handling constants
+typedef struct
+{
+    float ang_gain;         // Target angular speed per unit of turbo difference
+    float accel;            // Fraction of the way to the target speeds covered each frame
+    float ice_accel;        // Same, for the velocity on ice
+    float crash_speed;      // Speed lost in a hit above which the pod crashes
+} PhysicsParams;
+
+static const PhysicsParams DEFAULT_PHYSICS = {0.04, 0.1, 0.02, 0.15};
+
+// How pods are simulated. Float physics can give different races with different compilers or
+// math libraries, fixed-point physics gives the same race everywhere.
+typedef enum
+{
+    PHYSICS_FLOAT,
+    PHYSICS_FIXED,
+} PhysicsMode;
+
+// Obstacles of a square part of the world, with a uniform grid over them. A level of fixed size
+// is a single chunk, an endless level streams chunks of CHUNK_SIZE.
+typedef struct
+{
+    int origin_x, origin_z;     // Corner of cell (0, 0), in world units
+    int size;                   // Side, in world units
+    int grid_w;                 // Cells per side
+
+    Obstacle *objs;
+    unsigned int objs_count;
+
+    // Cell (x, z) holds objs indexes grid_objs[grid_start[c]] .. grid_objs[grid_start[c + 1] - 1],
+    // where c = z*grid_w + x. Obstacles outside the chunk are stored in the nearest border cell.
+    int *grid_start;
+    int *grid_objs;
+
+    // Compact copy of the obstacle positions read by the collision queries. Entry k is the
+    // obstacle grid_objs[k], its position from the origin quantized to 1/OBJS_QUANT units.
+    int16_t *objs_qx;
+    int16_t *objs_qz;
+} LevelChunk;
+
+typedef struct ChunkCache ChunkCache;
+
+// Generated level. A level of fixed size is not modified while racing, so many races can share
+// it, even from several threads. Endless levels load chunks while racing (see chunks), so their
+// races and queries take a non-const Level and must all run on the thread that owns it.
+typedef struct
+{
+    LevelArea area;
+    uint64_t seed;
+
+    PhysicsParams physics;
+    PhysicsMode physics_mode;   // PHYSICS_FLOAT unless changed after the level is generated
+
+    int map_size;               // 0 for endless levels
+    bool endless;
+
+    // Obstacles of a level of fixed size, a single chunk built once the level is generated
+    LevelChunk map;
+
+    // Chunks of an endless level, in a bounded cache where the least recently used ones are
+    // replaced. A collision query that needs a chunk which isn't loaded generates it right away,
+    // stalling that query, and updates the cache. Chunks are generated from the seed and their
+    // coordinates only, so what is loaded never changes what a query finds, only how long it takes.
+    ChunkCache *chunks;
+    int chunk_objs;             // Obstacles per chunk
+
+    // All the obstacles of a level have the same radius
+    float objs_rad;
+
+    // Free space around each cell of the map: Chebyshev distance, in cells, to the nearest cell
+    // touched by an obstacle (capped at 255). Carrots spawn at the center of cells inside the map
+    // with at least CARROT_SPAWN_CLEARANCE, listed in spawn_cells. Unused by endless levels.
+    uint8_t *clearance;
+    int *spawn_cells;
+    int spawn_cells_count;
+
+    // Moving hazards (traffic) of levels of fixed size: cars on the city, seals on the ice. Each
+    // one goes back and forth along a lane of free cells and its place only depends on the race
+    // clock, so races are still saved by copying the pods. Structure of arrays, in 1/OBJS_QUANT
+    // units: hazard i starts at (traffic_qx[i], traffic_qz[i]) and goes traffic_len[i] along
+    // (traffic_dx[i], traffic_dz[i]), moving traffic_spd[i] each frame. At clock 0 it is
+    // traffic_phase[i] into its round trip.
+    int traffic_count;
+    int16_t *traffic_qx, *traffic_qz;
+    int16_t *traffic_dx, *traffic_dz;
+    int16_t *traffic_len;
+    int16_t *traffic_spd;
+    int16_t *traffic_phase;
+    float traffic_rad;
+
+    // Coarse grid over the lanes, with TRAFFIC_CELL_SIZE cells. Lanes never change, so it is built
+    // once like the obstacle grid: cell c holds the hazards traffic_ids[traffic_start[c]] ..
+    // traffic_ids[traffic_start[c + 1] - 1] whose lane touches it.
+    int *traffic_start;
+    int *traffic_ids;
+    int traffic_grid_w;
+} Level;
+
+// Pod and race progress of one player
+typedef struct
+{
+    float ang, ang_spd;
+
+    Vector3 pos, pos_spd;
+
+    float turbo_l, turbo_r;
+
+    int time_death;
+
+    int n_carrots;
+    Vector3 carrot_pos;
+    int carrot_grab_anim;
+
+    int time_playing;
+    float time_finish;      // Race clock when the last carrot was grabbed, with sub-frame precision
+
+    uint64_t rng;
+
+    // Pod state of the fixed-point physics, ang, ang_spd, pos and pos_spd are taken from it
+    uint32_t fx_ang;            // Binary angle
+    int32_t fx_ang_spd;         // Binary angle per frame
+    FixedVector3 fx_pos, fx_pos_spd;
+} Player;
+
+// Everything that changes during a race of several pods. The level is not part of it, since it
+// isn't modified while racing, so a race is saved and restored by copying this struct.
+// The pods are stored as structure of arrays, pod i is entry i of each array: every phase of a
+// frame goes through one field of all the pods at once. RacePlayer and RaceSetPlayer convert a pod
+// from and to a Player.
+typedef struct
+{
+    int players_count;
+    int frame;              // Frames simulated
+
+    // Pose and speed, the fields read and written by every phase
+    float ang[RACE_MAX_PLAYERS], ang_spd[RACE_MAX_PLAYERS];
+    float pos_x[RACE_MAX_PLAYERS], pos_y[RACE_MAX_PLAYERS], pos_z[RACE_MAX_PLAYERS];
+    float spd_x[RACE_MAX_PLAYERS], spd_y[RACE_MAX_PLAYERS], spd_z[RACE_MAX_PLAYERS];
+
+    uint32_t fx_ang[RACE_MAX_PLAYERS];
+    int32_t fx_ang_spd[RACE_MAX_PLAYERS];
+    Fixed fx_pos_x[RACE_MAX_PLAYERS], fx_pos_y[RACE_MAX_PLAYERS], fx_pos_z[RACE_MAX_PLAYERS];
+    Fixed fx_spd_x[RACE_MAX_PLAYERS], fx_spd_y[RACE_MAX_PLAYERS], fx_spd_z[RACE_MAX_PLAYERS];
+
+    // Controls and race progress
+    float turbo_l[RACE_MAX_PLAYERS], turbo_r[RACE_MAX_PLAYERS];
+    int time_death[RACE_MAX_PLAYERS];
+    int n_carrots[RACE_MAX_PLAYERS];
+    Vector3 carrot_pos[RACE_MAX_PLAYERS];
+    int carrot_grab_anim[RACE_MAX_PLAYERS];
+    int time_playing[RACE_MAX_PLAYERS];
+    float time_finish[RACE_MAX_PLAYERS];
+    uint64_t rng[RACE_MAX_PLAYERS];
+} RaceState;
+
+// Controls for one simulation step, turbos go from 0 to 2
+typedef struct
+{
+    float turbo_l, turbo_r;
+} PlayerInput;
+
+// Things that happened during a simulation step, as flags
+typedef enum
+{
+    SIM_EVENT_NONE = 0,
+    SIM_EVENT_CRASH = 1 << 0,           // The pod crashed
+    SIM_EVENT_GAME_OVER = 1 << 1,       // The crash animation is over
+    SIM_EVENT_CARROT = 1 << 2,          // A carrot was grabbed
+    SIM_EVENT_CARROT_END = 1 << 3,      // The carrot grab animation is over, the race goes on
+    SIM_EVENT_FINISH = 1 << 4,          // The last carrot grab animation is over
+} SimEvent;
+
+//----------------------------------------------------------------------------------
+// Global Variables Declaration
+//----------------------------------------------------------------------------------
+extern unsigned int simAllocations;     // Heap allocations done by the simulation so far
+
+#ifdef __cplusplus
+extern "C" {            // Prevents name mangling of functions
+#endif
+
+//----------------------------------------------------------------------------------
+// Simulation Functions Declaration
+//----------------------------------------------------------------------------------
+Level *LevelGenerate(LevelArea area, uint64_t seed);
+Level *LevelGenerateEndless(LevelArea area, uint64_t seed);
+void UnloadLevel(Level *level);
+
+void LevelStreamChunks(Level *level, Vector3 pos, int budget);
+int LevelChunksNear(const Level *level, Vector3 pos, float dist, const LevelChunk **chunks, int max);
+
+bool LevelCheckCollision(Level *level, Vector3 point, float rad, int clock);
+SweepResult LevelSweepCollision(Level *level, Vector3 point, Vector3 delta, float rad);
+SweepResult LevelSweepTraffic(const Level *level, Vector3 point, Vector3 delta, float rad, int clock, int frames);
+void LevelRespawnCarrot(const Level *level, Player *player);
+void LevelTrafficPositions(const Level *level, float clock, float *xs, float *zs);
+
+void InitPlayer(const Level *level, Player *player);
+int UpdatePlayer(Level *level, Player *player, PlayerInput input);
+
+void InitRace(const Level *level, RaceState *race, int players_count);
+void UpdateRace(Level *level, RaceState *race, const PlayerInput *inputs, int *events);
+Player RacePlayer(const RaceState *race, int index);
+void RaceSetPlayer(RaceState *race, int index, const Player *player);
+
+Player InterpolatePlayer(const Player *prev, const Player *next, float t);
+
+float CarrotAngle(const Player *player);
+float CarrotDistance(const Player *player);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SIMULATION_H
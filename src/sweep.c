@@ -0,0 +1,304 @@
+/*******************************************************************************************
+*
+*   Nokia Pod Racer
+*   Physics parameter sweep: races every combination of the given handling constants over
+*   many seeded levels, headless and on all the cores, and reports how each one plays.
+*
+*   Every value option takes a comma separated list, the sets raced are all their
+*   combinations. Options that are not given keep the game value.
+*
+*   Usage: sweep [--ang-gain 0.04] [--accel 0.1] [--ice-accel 0.02] [--crash-speed 0.15]
+*                [--area all|city|forest|lights|ice] [--seeds 100] [--input autopilot|scripted]
+*                [--max-frames 36000] [--threads N]
+*
+*   Copyright (c) 2023 Francisco Casas (@autopawn)
+*
+********************************************************************************************/
+
+#include "raylib.h"
+#include "simulation.h"
+#include "autopilot.h"
+#include "jobs.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SWEEP_SEED 0x5eed
+#define SWEEP_MAX_VALUES 16
+#define SWEEP_MAX_SETS 4096
+
+//----------------------------------------------------------------------------------
+// Types and Structures Definition
+//----------------------------------------------------------------------------------
+typedef enum
+{
+    RACE_FINISHED,
+    RACE_CRASHED,
+    RACE_TIMEOUT,
+} RaceOutcome;
+
+typedef struct
+{
+    RaceOutcome outcome;
+    int frames;             // Simulated frames
+    int time;               // Race time, when finished
+} RaceResult;
+
+typedef struct
+{
+    const PhysicsParams *sets;
+    int sets_count;
+
+    LevelArea areas[LEVEL_COUNT];
+    int areas_count;
+
+    int seeds;
+    int max_frames;
+    bool autopilot;
+
+    RaceResult *results;    // results[job*sets_count + set], a job is one level
+} Sweep;
+
+//----------------------------------------------------------------------------------
+// Module Functions Definition
+//----------------------------------------------------------------------------------
+static double Now(void)
+{
+    struct timespec ts;
+
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+// Parses a comma separated list of values, returns how many were read
+static int ParseValues(const char *text, float *values)
+{
+    int count = 0;
+    char *end;
+
+    while (count < SWEEP_MAX_VALUES)
+    {
+        values[count] = strtof(text, &end);
+        if (end == text)
+            break;
+        count++;
+        if (*end != ',')
+            break;
+        text = end + 1;
+    }
+
+    return count;
+}
+
+// Gentle slalom, the same for every race
+static PlayerInput ScriptedInput(int time_playing)
+{
+    return (PlayerInput){1.0f, 1.0f + 0.3f*((time_playing/120)%2)};
+}
+
+// Races a single pod, kept as a race of one so it isn't copied in and out on every frame
+static RaceResult RunRace(Level *level, bool autopilot, int max_frames)
+{
+    RaceState race;
+    InitRace(level, &race, 1);
+
+    for (int frame = 0; frame < max_frames; ++frame)
+    {
+        PlayerInput input;
+
+        if (autopilot)
+        {
+            Player player = RacePlayer(&race, 0);
+            input = AutopilotInput(level, &player);
+        }
+        else
+            input = ScriptedInput(race.time_playing[0]);
+
+        int events;
+        UpdateRace(level, &race, &input, &events);
+
+        // No need to wait for the animations
+        if (events & SIM_EVENT_CRASH)
+            return (RaceResult){RACE_CRASHED, frame + 1, 0};
+        if (race.n_carrots[0] == TARGET_N_CARROTS)
+            return (RaceResult){RACE_FINISHED, frame + 1, race.time_playing[0]};
+    }
+
+    return (RaceResult){RACE_TIMEOUT, max_frames, 0};
+}
+
+// Generates one level and races it with every parameter set
+static void RunSweepJob(void *data, int job, int worker)
+{
+    (void) worker;
+
+    Sweep *sweep = data;
+    LevelArea area = sweep->areas[job/sweep->seeds];
+    Level *level = LevelGenerate(area, SWEEP_SEED + job%sweep->seeds);
+
+    for (int i = 0; i < sweep->sets_count; ++i)
+    {
+        level->physics = sweep->sets[i];
+        sweep->results[job*sweep->sets_count + i] = RunRace(level, sweep->autopilot, sweep->max_frames);
+    }
+
+    UnloadLevel(level);
+}
+
+static int CompareInts(const void *a, const void *b)
+{
+    int ia = *(const int *) a;
+    int ib = *(const int *) b;
+
+    return (ia > ib) - (ia < ib);
+}
+
+static void PrintUsage(const char *name)
+{
+    fprintf(stderr, "usage: %s [--ang-gain 0.04] [--accel 0.1] [--ice-accel 0.02] [--crash-speed 0.15]\n"
+            "    [--area all|city|forest|lights|ice] [--seeds 100] [--input autopilot|scripted]\n"
+            "    [--max-frames 36000] [--threads N]\n", name);
+}
+
+//----------------------------------------------------------------------------------
+// Main entry point
+//----------------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+    const char *areaNames[LEVEL_COUNT] = { "city", "forest", "lights", "ice" };
+
+    // Values of each parameter, in PhysicsParams order
+    float values[4][SWEEP_MAX_VALUES] = {
+        {DEFAULT_PHYSICS.ang_gain}, {DEFAULT_PHYSICS.accel}, {DEFAULT_PHYSICS.ice_accel}, {DEFAULT_PHYSICS.crash_speed}
+    };
+    int counts[4] = {1, 1, 1, 1};
+    const char *options[4] = {"--ang-gain", "--accel", "--ice-accel", "--crash-speed"};
+
+    Sweep sweep = {0};
+    sweep.seeds = 100;
+    sweep.max_frames = 36000;
+    sweep.autopilot = true;
+
+    const char *area = "all";
+    int threads = GetCoreCount();
+
+    for (int i = 1; i < argc; ++i)
+    {
+        bool parsed = false;
+
+        for (int j = 0; j < 4; ++j)
+        {
+            if (!strcmp(argv[i], options[j]) && i + 1 < argc)
+            {
+                counts[j] = ParseValues(argv[++i], values[j]);
+                parsed = counts[j] > 0;
+            }
+        }
+        if (parsed)
+            continue;
+
+        if (!strcmp(argv[i], "--area") && i + 1 < argc)
+            area = argv[++i];
+        else if (!strcmp(argv[i], "--seeds") && i + 1 < argc)
+            sweep.seeds = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--input") && i + 1 < argc)
+            sweep.autopilot = strcmp(argv[++i], "scripted");
+        else if (!strcmp(argv[i], "--max-frames") && i + 1 < argc)
+            sweep.max_frames = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+            threads = atoi(argv[++i]);
+        else
+        {
+            PrintUsage(argv[0]);
+            return 2;
+        }
+    }
+
+    for (int i = 0; i < LEVEL_COUNT; ++i)
+    {
+        if (!strcmp(area, "all") || !strcmp(area, areaNames[i]))
+            sweep.areas[sweep.areas_count++] = i;
+    }
+
+    int sets_count = counts[0]*counts[1]*counts[2]*counts[3];
+
+    if (sweep.areas_count == 0 || sweep.seeds < 1 || sets_count > SWEEP_MAX_SETS)
+    {
+        PrintUsage(argv[0]);
+        return 2;
+    }
+
+    SetTraceLogLevel(LOG_WARNING);
+
+    // Every combination of the values
+    PhysicsParams *sets = calloc(sets_count, sizeof(*sets));
+
+    for (int i = 0; i < sets_count; ++i)
+    {
+        int rest = i;
+        float set[4];
+
+        for (int j = 3; j >= 0; --j)
+        {
+            set[j] = values[j][rest%counts[j]];
+            rest /= counts[j];
+        }
+        sets[i] = (PhysicsParams){set[0], set[1], set[2], set[3]};
+    }
+
+    int jobs = sweep.areas_count*sweep.seeds;
+
+    sweep.sets = sets;
+    sweep.sets_count = sets_count;
+    sweep.results = calloc((size_t) jobs*sets_count, sizeof(*sweep.results));
+
+    double start = Now();
+    RunJobs(RunSweepJob, &sweep, jobs, threads);
+    double elapsed = Now() - start;
+
+    // Report each set
+    int *times = calloc(jobs, sizeof(*times));
+    long long frames = 0;
+
+    printf("%-9s %-9s %-9s %-11s %6s %9s %8s %8s %9s %9s\n", "ang_gain", "accel", "ice_accel", "crash_speed",
+            "races", "finished", "crashed", "timeout", "mean_time", "p50_time");
+
+    for (int i = 0; i < sets_count; ++i)
+    {
+        int outcomes[3] = {0};
+        long long time_sum = 0;
+
+        for (int job = 0; job < jobs; ++job)
+        {
+            RaceResult result = sweep.results[job*sets_count + i];
+
+            outcomes[result.outcome]++;
+            frames += result.frames;
+            if (result.outcome == RACE_FINISHED)
+            {
+                times[outcomes[RACE_FINISHED] - 1] = result.time;
+                time_sum += result.time;
+            }
+        }
+
+        int finished = outcomes[RACE_FINISHED];
+        qsort(times, finished, sizeof(*times), CompareInts);
+
+        // Times in seconds, at 60 frames per second as in the game
+        printf("%-9g %-9g %-9g %-11g %6d %8.1f%% %7.1f%% %7.1f%% %8.2fs %8.2fs\n",
+                sets[i].ang_gain, sets[i].accel, sets[i].ice_accel, sets[i].crash_speed, jobs,
+                100.0*finished/jobs, 100.0*outcomes[RACE_CRASHED]/jobs, 100.0*outcomes[RACE_TIMEOUT]/jobs,
+                finished ? time_sum/60.0/finished : 0, finished ? times[finished/2]/60.0 : 0);
+    }
+
+    printf("%d races in %.2f s on %d threads: %.0f races/s, %.0f frames/s\n", jobs*sets_count, elapsed,
+            threads, jobs*sets_count/elapsed, frames/elapsed);
+
+    free(times);
+    free(sweep.results);
+    free(sets);
+
+    return 0;
+}
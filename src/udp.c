@@ -0,0 +1,118 @@
+/*******************************************************************************************
+*
+*   Nokia Pod Racer
+*   UDP sockets on the loopback interface, for head-to-head races between two local games.
+*
+*   Copyright (c) 2023 Francisco Casas (@autopawn)
+*
+********************************************************************************************/
+
+#include "udp.h"
+
+#if defined(_WIN32)
+    #include <winsock2.h>
+    typedef int socklen_t;
+#elif !defined(PLATFORM_WEB)
+    #include <arpa/inet.h>
+    #include <fcntl.h>
+    #include <netinet/in.h>
+    #include <sys/socket.h>
+    #include <unistd.h>
+#endif
+
+#include <string.h>
+
+//----------------------------------------------------------------------------------
+// Module Functions Definition
+//----------------------------------------------------------------------------------
+
+#if !defined(PLATFORM_WEB)
+static struct sockaddr_in LoopbackAddress(int port)
+{
+    struct sockaddr_in addr;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+
+    return addr;
+}
+#endif
+
+// Opens a non-blocking socket bound to the given loopback port, returns -1 on failure
+int UdpOpen(int port)
+{
+#if defined(PLATFORM_WEB)
+    (void) port;
+    return -1;
+#else
+    #if defined(_WIN32)
+        WSADATA wsa;
+        if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0)
+            return -1;
+    #endif
+
+    int sock = (int) socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0)
+        return -1;
+
+    struct sockaddr_in addr = LoopbackAddress(port);
+
+    #if defined(_WIN32)
+        u_long nonBlocking = 1;
+        bool ready = ioctlsocket(sock, FIONBIO, &nonBlocking) == 0;
+    #else
+        bool ready = fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK) == 0;
+    #endif
+
+    if (!ready || bind(sock, (struct sockaddr *) &addr, sizeof(addr)) != 0)
+    {
+        UdpClose(sock);
+        return -1;
+    }
+
+    return sock;
+#endif
+}
+
+void UdpClose(int socket)
+{
+#if defined(_WIN32)
+    closesocket(socket);
+    WSACleanup();
+#elif !defined(PLATFORM_WEB)
+    close(socket);
+#else
+    (void) socket;
+#endif
+}
+
+// Sends a datagram to the given loopback port
+bool UdpSend(int socket, int port, const uint8_t *data, int size)
+{
+#if defined(PLATFORM_WEB)
+    (void) socket; (void) port; (void) data; (void) size;
+    return false;
+#else
+    struct sockaddr_in addr = LoopbackAddress(port);
+
+    return sendto(socket, (const char *) data, size, 0, (struct sockaddr *) &addr, sizeof(addr)) == size;
+#endif
+}
+
+// Reads the next datagram, if there is one. Returns its size, or -1 if there is none.
+int UdpReceive(int socket, uint8_t *data, int capacity)
+{
+#if defined(PLATFORM_WEB)
+    (void) socket; (void) data; (void) capacity;
+    return -1;
+#else
+    struct sockaddr_in addr;
+    socklen_t addrSize = sizeof(addr);
+
+    int size = (int) recvfrom(socket, (char *) data, capacity, 0, (struct sockaddr *) &addr, &addrSize);
+
+    return (size < 0)? -1 : size;
+#endif
+}
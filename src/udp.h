@@ -0,0 +1,36 @@
+/*******************************************************************************************
+*
+*   Nokia Pod Racer
+*   UDP sockets on the loopback interface, for head-to-head races between two local games.
+*
+*   This module doesn't include raylib, so the platform socket headers don't clash with it.
+*   Sockets are not available on web, where opening one always fails.
+*
+*   Copyright (c) 2023 Francisco Casas (@autopawn)
+*
+********************************************************************************************/
+
+#ifndef UDP_H
+#define UDP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {            // Prevents name mangling of functions
+#endif
+
+//----------------------------------------------------------------------------------
+// UDP Functions Declaration
+//----------------------------------------------------------------------------------
+int UdpOpen(int port);
+void UdpClose(int socket);
+
+bool UdpSend(int socket, int port, const uint8_t *data, int size);
+int UdpReceive(int socket, uint8_t *data, int capacity);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // UDP_H